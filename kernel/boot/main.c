@@ -7,6 +7,11 @@ extern void init_page(void);
 extern void init_slot(void);
 extern void init_trap(void);
 extern void init_plic(void);
+extern void init_rq(void);
+extern void init_timerq(void);
+extern void init_futex(void);
+extern void init_fpu(void);
+extern void init_kworker(void);
 extern void init_proc1(void);
 extern void init_console(void);
 extern void init_bcache(void);
@@ -28,6 +33,10 @@ main(void)
     init_bcache(); // IO缓冲区初始化
     init_icache(); // inode表初始化
     init_disk();   // 硬盘初始化
+    init_rq();     // 运行队列与等待队列初始化
+    init_timerq(); // 定时器队列初始化
+    init_futex();  // futex哈希桶初始化
+    init_fpu();    // 探测向量扩展
     init_proc1();  // 启动1号用户任务
     __sync_synchronize();
     cpu_ok = true;
@@ -39,6 +48,7 @@ main(void)
     init_plic();
     __sync_synchronize();
   }
+  init_kworker(); // 本cpu的内核工作线程,在1号任务之后创建
   sti();
   task_schedule();
 }
@@ -5,16 +5,20 @@
 struct pt_regs;
 extern void main(void);
 extern int do_trap(struct pt_regs*, u64);
+extern void mtrap_entry(void);
 
 __attribute__((aligned(16))) char cpu_stack[PGSIZE * NCPU];
 
 struct cpu cpus[NCPU];
 
+static u64 mscratch[NCPU][2]; // M模式核间中断处理的暂存区
+
 static void
 init_timer(void)
 {
   w_menvcfg(r_menvcfg() | (1UL << 63)); // 为 S 模式启用 stimecmp
   w_mcounteren(r_mcounteren() | 2);     // 使能S\U模式下的 time 系统寄存器
+  w_scounteren(r_scounteren() | 2);     // 用户态可以直接读time(rdtime),用于计时
   w_stimecmp(r_time() + TIME_CYCLE);
 }
 
@@ -48,6 +52,11 @@ start(void)
 
   init_timer();
   w_sie(r_sie() | SIE_STIE | SIE_SSIE);
+
+  // 核间中断: S模式写CLINT的msip触发目标核的M模式软件中断,由mtrap_entry转为S模式软件中断
+  w_mscratch((u64)mscratch[cpuid]);
+  w_mtvec((u64)mtrap_entry);
+  w_mie(r_mie() | MIE_MSIE);
   asm volatile("mret");
 
   // mret做的事
@@ -1,5 +1,11 @@
 #pragma once
-#define NPROC 32 // 最大进程数
+#define NPROC     256 // 最大任务数(含每个cpu的内核工作线程)
+#define NWAITQ    64  // 等待队列哈希桶数
+#define NFUTEX    64  // futex哈希桶数
+#define NTASKRES  4   // 每个cpu缓存的已初始化任务资源数
+#define NKWORKER  1   // 每个cpu的内核工作线程数,即每个cpu上同时执行的work数上限
+#define NWORK     32  // 每个cpu的工作队列最多容纳的work数
+#define NSPINNODE 8   // 每个cpu同时持有或等待的自旋锁上限,即MCS队列节点数
 
 // 页大小
 #define PGSIZE  4096UL
@@ -7,9 +13,10 @@
 #define GPGSIZE (PGSIZE << 18) // 1GB
 
 #define NSLOT_DEFAULT   3
-#define NVMA_SLOT       NSLOT_DEFAULT
-#define NMM_STURCT_SLOT NSLOT_DEFAULT
-#define NFS_STRUCT_SLOT NSLOT_DEFAULT
+#define NVMA_MAX        64                      // 每个地址空间的vma上限,munmap拆分vma后数量会增多
+#define NVMA_SLOT       (NPROC * NVMA_MAX / 32) // 每页至少容纳32个vma,所有地址空间都达到上限时也不会耗尽
+#define NMM_STURCT_SLOT ((NPROC + NCPU * NTASKRES) / 16) // 每页至少容纳16个,任务满且各cpu的资源缓存也满时不会耗尽
+#define NFS_STRUCT_SLOT (NPROC / 8)                      // 每页至少容纳8个
 #define NFILE_SLOT      NSLOT_DEFAULT
 #define NINODE_SLOT     NSLOT_DEFAULT
 
@@ -19,6 +26,7 @@
 #define TRAMPOLINE (VA_TOP - PGSIZE)     // 用于模式切换的跳板页高虚拟地址起始处
 #define TRAPFRAME  (TRAMPOLINE - PGSIZE) // 用于模式切换的TRAP页高虚拟地址起始处
 #define USTACK     (TRAPFRAME - PGSIZE)  // 用户栈的起始地址
+#define MMAP_BASE  (VA_TOP >> 1)         // 文件映射区起始地址,堆区不能越过此处
 #define PHY_MEMORY 0x80000000UL
 #define PHY_SIZE   0x20000000UL // 512MB
 #define PHY_TOP    (PHY_MEMORY + PHY_SIZE)
@@ -26,8 +34,14 @@
 #define KBASE      PHY_MEMORY // 内核代码起始处
 
 // 硬件属性
-#define NCPU       8
-#define TIME_CYCLE 10000000UL // 时间片
+#define NCPU          64         // 最大hart数,cpumask为u64,不能超过64
+#define TIME_CYCLE    10000000UL // 时间片
+#define TIMEBASE_FREQ 10000000UL // time寄存器频率(Hz)
+#define CACHE_LINE    64         // 各cpu频繁写入的数据按缓存行对齐,避免伪共享
+
+// 实时任务限流: 每个周期内实时任务在一个cpu上最多运行RT_RUNTIME,其余时间留给普通任务
+#define RT_PERIOD  TIMEBASE_FREQ // 1s
+#define RT_RUNTIME (RT_PERIOD / 20 * 19)
 
 #define CLINT      0x2000000UL
 #define CLINT_SIZE 0x10000UL
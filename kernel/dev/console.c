@@ -127,7 +127,10 @@ console_read(void* udst, u32 len)
 {
   spin_get(&con.lock);
   while (console_isempty())
-    sleep(&con.r, &con.lock);
+    if (! sleep_killable(&con.r, &con.lock)) {
+      spin_put(&con.lock);
+      return 0;
+    }
   len = min(len, console_readable_len());
   if (con.r < con.w)
     copy_to_user(udst, con.buf + con.r, len);
@@ -5,6 +5,7 @@
 #include "fs/dir.h"
 #include "fs/bio.h"
 #include "fs/pipe.h"
+#include "task/sche.h"
 #include "util/spinlock.h"
 #include "util/printf.h"
 #include "util/string.h"
@@ -71,34 +72,74 @@ blockno_of_data(struct file* f, u32 off)
   u32* iblock = f->inode->di.iblock;
   if (off < BSIZE * NDIRECT)
     return iblock[off / BSIZE];
-  u32 i = (off - BSIZE * NDIRECT) / IDX_CNT_PER_INDIRECT_BLCOK;
+  u32 i = (off / BSIZE - NDIRECT) / IDX_CNT_PER_INDIRECT_BLCOK;
   struct buf* b = bread(f->inode->sb->dev, iblock[i + NDIRECT]);
   u32 r = ((u32*)b->data)[off / BSIZE - NDIRECT - i * IDX_CNT_PER_INDIRECT_BLCOK];
   brelse(b);
   return r;
 }
 
-u32
-fread(struct file* f, void* buf, u32 bytes, bool kernel)
+/*
+  在块缓存与buf之间交换数据,user为真时buf是用户地址
+  持有块缓存的锁时只做不缺页的拷贝: 用户缓冲区可能是同一文件尚未载入的mmap映射,缺页时会bread同一块;
+  持有mm->lock的munmap回写也会bread。遇到未映射的用户页时先释放块缓存,缺页处理后再重新bread继续
+*/
+static u32
+read_blocks(struct file* f, void* buf, u32 off, u32 bytes, bool user)
 {
-  u32 pcur = f->off;
-  u32 pend_bytes = min(bytes, f->inode->di.fsize - pcur), done_bytes = 0;
+  if (off >= f->inode->di.fsize)
+    return 0;
+  u32 pend_bytes = min(bytes, f->inode->di.fsize - off), done_bytes = 0;
   dev_t dev = f->inode->sb->dev;
-  struct buf* b;
 
   while (pend_bytes) {
-    u32 len = min(BSIZE - pcur % BSIZE, pend_bytes);
-    b = bread(dev, blockno_of_data(f, pcur));
-    if (kernel)
-      memcpy(buf + done_bytes, b->data + pcur % BSIZE, len);
+    u32 len = min(BSIZE - off % BSIZE, pend_bytes);
+    struct buf* b = bread(dev, blockno_of_data(f, off));
+    void* src = b->data + off % BSIZE;
+    u32 n = len;
+    if (user)
+      n = copy_to_user_nofault(buf + done_bytes, src, len);
     else
-      copy_to_user(buf + done_bytes, b->data + pcur % BSIZE, len);
+      memcpy(buf + done_bytes, src, len);
     brelse(b);
-    done_bytes += len;
-    pend_bytes -= len;
-    pcur += len;
+    if (n < len && ! do_page_fault((u64)buf + done_bytes + n, true))
+      kill();
+    done_bytes += n;
+    pend_bytes -= n;
+    off += n;
   }
+  return done_bytes;
+}
 
+// 把buf写入文件偏移off处的数据块,调用方保证数据块已分配
+static void
+write_blocks(struct file* f, const void* buf, u32 off, u32 bytes, bool user)
+{
+  dev_t dev = f->inode->sb->dev;
+  u32 done_bytes = 0;
+  while (done_bytes < bytes) {
+    u32 len = min(BSIZE - off % BSIZE, bytes - done_bytes);
+    struct buf* b = bread(dev, blockno_of_data(f, off));
+    void* dst = b->data + off % BSIZE;
+    u32 n = len;
+    if (user)
+      n = copy_from_user_nofault(dst, buf + done_bytes, len);
+    else
+      memcpy(dst, buf + done_bytes, len);
+    if (n)
+      bwrite(b);
+    brelse(b);
+    if (n < len && ! do_page_fault((u64)buf + done_bytes + n, false))
+      kill();
+    done_bytes += n;
+    off += n;
+  }
+}
+
+u32
+fread(struct file* f, void* buf, u32 bytes, bool kernel)
+{
+  u32 done_bytes = read_blocks(f, buf, f->off, bytes, ! kernel);
   f->off += done_bytes;
   return done_bytes;
 }
@@ -108,8 +149,6 @@ fwrite(struct file* f, const void* buf, u32 bytes, bool kernel)
 {
   u32 pcur = f->off;
   u32 free = f->inode->di.fsize - pcur;
-  dev_t dev = f->inode->sb->dev;
-  u32 pend_bytes = bytes, done_bytes = 0;
 
   struct buf* b;
   while (free < bytes) { // 扩容(申请新的数据块)
@@ -118,22 +157,28 @@ fwrite(struct file* f, const void* buf, u32 bytes, bool kernel)
     free += BSIZE;
   }
 
-  while (pend_bytes) {
-    u32 len = min(BSIZE - pcur % BSIZE, pend_bytes);
-    b = bread(dev, blockno_of_data(f, pcur));
-    if (kernel)
-      memcpy(b->data + pcur % BSIZE, buf + done_bytes, len);
-    else
-      copy_from_user(b->data + pcur % BSIZE, buf + done_bytes, len);
-    bwrite(b);
-    brelse(b);
-    done_bytes += len;
-    pend_bytes -= len;
-    pcur += len;
-  }
+  write_blocks(f, buf, pcur, bytes, ! kernel);
 
-  f->off += done_bytes;
-  f->inode->di.fsize += done_bytes;
+  f->off += bytes;
+  f->inode->di.fsize += bytes;
   iupdate(f->inode);
-  return done_bytes;
-}
\ No newline at end of file
+  return bytes;
+}
+
+// 从文件偏移off处读取至多bytes字节到内核缓冲区,不改变f->off
+u32
+fpread(struct file* f, void* buf, u32 off, u32 bytes)
+{
+  return read_blocks(f, buf, off, bytes, false);
+}
+
+// 从内核缓冲区写入至多bytes字节到文件偏移off处,不改变f->off,也不会扩展文件
+u32
+fpwrite(struct file* f, const void* buf, u32 off, u32 bytes)
+{
+  if (off >= f->inode->di.fsize)
+    return 0;
+  u32 len = min(bytes, f->inode->di.fsize - off);
+  write_blocks(f, buf, off, len, false);
+  return len;
+}
@@ -40,4 +40,6 @@ void fclose(struct file* f);
 u32 fseek(struct file* f, int off, int whence);
 u32 fread(struct file* f, void* buf, u32 bytes, bool kernel);
 u32 fwrite(struct file* f, const void* buf, u32 bytes, bool kernel);
+u32 fpread(struct file* f, void* buf, u32 off, u32 bytes);
+u32 fpwrite(struct file* f, const void* buf, u32 off, u32 bytes);
 #endif
\ No newline at end of file
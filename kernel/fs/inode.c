@@ -2,16 +2,22 @@
 #include "fs/inode.h"
 #include "fs/bio.h"
 #include "util/spinlock.h"
+#include "util/seqlock.h"
 #include "util/printf.h"
 #include "util/string.h"
+#include "task/sche.h"
 
 
 #define DINODE_CNT_PER_BLOCK (BSIZE / sizeof(struct dinode))
 
 
+/*
+  缓存项对应哪个inode(sb与inum)只在持有icache写锁与该项spin时修改,查找不加icache锁
+  多个任务同时解析路径时只在命中项的spin上短暂互斥
+*/
 static struct {
   struct inode inodes[NINODE];
-  struct spinlock lock;
+  struct seqlock lock;
 } icache;
 
 
@@ -143,6 +149,7 @@ itrunc(struct inode* in)
         brelse(bb);
         bfree(sb, *idx);
         ++idx;
+        preempt_point(); // 截断大文件耗时较长
       }
     }
     bzero(b);
@@ -174,31 +181,48 @@ ifree(struct inode* in)
 }
 
 
-struct inode*
-iget(struct superblock* sb, u32 inum)
+// 在缓存中查找inode并增加引用
+static struct inode*
+icache_find(struct superblock* sb, u32 inum)
 {
-  spin_get(&icache.lock);
   for (int i = 0; i < NINODE; ++i) {
-    spin_get(&icache.inodes[i].spin);
-    if (icache.inodes[i].sb == sb && icache.inodes[i].inum == inum) {
-      ++icache.inodes[i].refc;
-      spin_put(&icache.inodes[i].spin);
-      spin_put(&icache.lock);
-      return icache.inodes + i;
+    struct inode* in = icache.inodes + i;
+    if (in->sb != sb || in->inum != inum) // 无锁预判,命中后在spin内复查
+      continue;
+    spin_get(&in->spin);
+    if (in->sb == sb && in->inum == inum) {
+      ++in->refc;
+      spin_put(&in->spin);
+      return in;
     }
-    spin_put(&icache.inodes[i].spin);
+    spin_put(&in->spin);
   }
+  return NULL;
+}
+
+struct inode*
+iget(struct superblock* sb, u32 inum)
+{
+  struct inode* in;
+  u32 seq;
+  do {
+    seq = seq_rbegin(&icache.lock);
+    if ((in = icache_find(sb, inum)))
+      return in;
+  } while (seq_retry(&icache.lock, seq)); // 查找期间有缓存项被换出,未命中的结论不可信
 
   /*
-    涉及到阻塞的IO操作时必须要临时释放当前已经持有的所有自旋锁,
+    涉及到阻塞的IO操作时不能持有任何自旋锁,
     否则在多核场景下当某个线程因为IO操作被切走而后被另一个核心调度,
     在释放自旋锁的时会出现核心号不匹配的问题
   */
-  spin_put(&icache.lock);
-  struct inode* in = NULL;
   if (! iexist(sb, inum))
+    return NULL;
+  seq_wget(&icache.lock);
+  if ((in = icache_find(sb, inum))) { // IO期间可能已被其他任务换入
+    seq_wput(&icache.lock);
     return in;
-  spin_get(&icache.lock);
+  }
 
   for (int i = 0; i < NINODE; ++i) {
     spin_get(&icache.inodes[i].spin);
@@ -212,7 +236,7 @@ iget(struct superblock* sb, u32 inum)
     }
     spin_put(&icache.inodes[i].spin);
   }
-  spin_put(&icache.lock);
+  seq_wput(&icache.lock);
 
   if (in == NULL)
     panic("iget: icache exhausted");
@@ -360,7 +384,7 @@ idx_remove(struct inode* in, u32 i)
 void
 init_icache(void)
 {
-  icache.lock.lname = "icache";
+  icache.lock.lock.lname = "icache";
   for (int i = 0; i < NINODE; ++i) {
     icache.inodes[i].slep.lname = "inode-sleep";
     icache.inodes[i].spin.lname = "inode-spin";
@@ -59,7 +59,10 @@ piperead(struct pipe* p, void* udst, u32 len)
   u32 r;
   spin_get(&p->lock);
   while (pipe_isempty(p))
-    sleep(&p->nread, &p->lock);
+    if (! sleep_killable(&p->nread, &p->lock)) {
+      spin_put(&p->lock);
+      return 0;
+    }
   u32 bytes = min(len, pipe_readable_size(p));
   u32 start = p->nread % PIPE_SIZE;
   u32 total_read = 0;
@@ -86,7 +89,10 @@ pipewrite(struct pipe* p, const void* usrc, u32 len)
     u32 writable = pipe_writable_size(p);
     while (writable == 0) {
       wakeup(&p->nread);
-      sleep(&p->nwrite, &p->lock);
+      if (! sleep_killable(&p->nwrite, &p->lock)) {
+        spin_put(&p->lock);
+        return total_written;
+      }
       writable = pipe_writable_size(p);
     }
     u32 start = p->nwrite % PIPE_SIZE;
@@ -17,10 +17,26 @@ page(u64 paddr)
 
 INIT_SPINLOCK(mem_spin);
 INIT_LIST(pages_head);
+static u64 nfree; // 全局链表中的空闲物理页数
+
+/*
+  每个cpu缓存少量空闲页,分配与释放先在本cpu的缓存中关中断进行,每次成批(PCP_BATCH页)与全局链表交换,
+  多个cpu频繁分配释放时不必每页都争用mem_spin;缓存超过PCP_HIGH页时归还一批
+  ! 全局链表耗尽时不会从其他cpu的缓存中回收,最多有NCPU*PCP_HIGH页留在缓存中
+*/
+#define PCP_BATCH 8
+#define PCP_HIGH  32
+struct pcp {
+  struct list_node head;
+  u64 cnt;
+} __attribute__((aligned(CACHE_LINE)));
+static struct pcp pcps[NCPU];
 
 void
 init_memory(void)
 {
+  for (int i = 0; i < NCPU; ++i)
+    list_init(&pcps[i].head);
   for (u64 phy_addr = PHY_MEMORY; phy_addr < PHY_TOP; phy_addr += PGSIZE) {
     struct page* p = phy_mem + page_num(phy_addr);
 
@@ -30,20 +46,52 @@ init_memory(void)
     } else {
       p->inuse = false;
       list_pushback(&pages_head, &p->page_node);
+      ++nfree;
     }
   }
 }
 
+u64
+free_page_cnt(void)
+{
+  u64 n = nfree;
+  for (int i = 0; i < NCPU; ++i)
+    n += pcps[i].cnt;
+  return n;
+}
+
+// 在src与dst之间移动至多n页,调用方持有mem_spin
+static u64
+move_pages(struct list_node* dst, struct list_node* src, u64 n)
+{
+  u64 i = 0;
+  for (; i < n && src->next != src; ++i) {
+    struct list_node* node = src->next;
+    list_remove(node);
+    list_pushback(dst, node);
+  }
+  return i;
+}
+
 struct page*
 alloc_page(void)
 {
-  spin_get(&mem_spin);
-  if (pages_head.next == &pages_head)
-    panic("alloc_page: memory exhausted");
-  struct page* p = container_of(pages_head.next, struct page, page_node);
+  push_intr();
+  struct pcp* pc = &pcps[cpuid()];
+  if (pc->cnt == 0) {
+    spin_get(&mem_spin);
+    u64 n = move_pages(&pc->head, &pages_head, PCP_BATCH);
+    nfree -= n;
+    spin_put(&mem_spin);
+    if (n == 0)
+      panic("alloc_page: memory exhausted");
+    pc->cnt = n;
+  }
+  struct page* p = container_of(pc->head.next, struct page, page_node);
+  list_remove(&p->page_node);
+  --pc->cnt;
   p->inuse = true;
-  list_remove(pages_head.next);
-  spin_put(&mem_spin);
+  pop_intr();
   memset((void*)p->paddr, 0, PGSIZE);
   return p;
 }
@@ -59,10 +107,18 @@ alloc_page_for_task(struct task* t)
 void
 free_page(struct page* p)
 {
-  spin_get(&mem_spin);
+  push_intr();
   if (! p->inuse)
     panic("free_page: double free page");
   p->inuse = false;
-  list_pushback(&pages_head, &p->page_node);
-  spin_put(&mem_spin);
+  struct pcp* pc = &pcps[cpuid()];
+  list_pushback(pc->head.next, &p->page_node); // 放在缓存队首,最近释放的页先被分配
+  if (++pc->cnt > PCP_HIGH) {
+    spin_get(&mem_spin);
+    u64 n = move_pages(&pages_head, &pc->head, PCP_BATCH);
+    nfree += n;
+    spin_put(&mem_spin);
+    pc->cnt -= n;
+  }
+  pop_intr();
 }
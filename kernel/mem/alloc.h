@@ -7,6 +7,7 @@ struct page {
   struct list_node page_node;
   u64 paddr;
   bool inuse;
+  u32 share; // 映射该页的地址空间数,0表示属于某个地址空间的私有页链表;fork共享MAP_SHARED页时才非0
 };
 
 struct page* page(u64 paddr);
@@ -15,6 +16,7 @@ struct page* page(u64 paddr);
 struct page* alloc_page(void);
 struct page* alloc_page_for_task(struct task* t);
 void free_page(struct page* p);
+u64 free_page_cnt(void); // 仅供参考,返回后随时可能变化
 static inline __attribute__((always_inline)) void
 free_page_for_task(struct page* p)
 {
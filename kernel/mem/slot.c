@@ -62,8 +62,11 @@
   }
 
 slot_define(vma_slot, NVMA_SLOT, struct vma);
+static_assert(NVMA_SLOT * (PGSIZE / sizeof(struct chunk_vma_slot)) >= NPROC * NVMA_MAX, "vma slot too small");
 slot_define(mm_struct_slot, NMM_STURCT_SLOT, struct mm_struct);
+static_assert(NMM_STURCT_SLOT * (PGSIZE / sizeof(struct chunk_mm_struct_slot)) >= NPROC + NCPU * NTASKRES, "mm_struct slot too small");
 slot_define(fs_struct_slot, NFS_STRUCT_SLOT, struct fs_struct);
+static_assert(NFS_STRUCT_SLOT * (PGSIZE / sizeof(struct chunk_fs_struct_slot)) >= NPROC, "fs_struct slot too small");
 slot_define(file_slot, NFILE_SLOT, struct file);
 
 void
@@ -13,6 +13,9 @@
 pagetable_t kernel_pgt; // 内核根页表
 u64 kernel_satp;
 
+// 全局只读零页: 匿名内存的读缺页都映射到此页,首次写入时才分配私有页
+static char zero_page[PGSIZE] __attribute__((aligned(PGSIZE)));
+
 extern char etext[];
 extern char trampoline[];
 extern char brodata[];
@@ -68,8 +71,10 @@ do_vmmap(pagetable_t ptb, u64 va, u64 pa, u64 size, u16 attr, i8 gra, struct tas
       if (! (*pte & PTE_V)) { // 需要创建非叶子 PTE（指向下一级页表）
         struct page* p = alloc_page();
         u64 new_pt_pa = p->paddr;
-        if (ut) // 非内核页表映射
+        if (ut) { // 非内核页表映射
           list_pushback(&ut->mm_struct->page_head, &p->page_node);
+          ++ut->mm_struct->nptable;
+        }
         *pte = ((new_pt_pa >> 12) << 10) | PTE_V;
       }
       cur = (pte_t*)((*pte >> 10) << 12); // 进入下一级页表
@@ -89,63 +94,346 @@ mvmmap(pagetable_t ptb, u64 va, u64 pa, u64 size, u16 attr)
 }
 
 
-//! trampoline,trapframe页的映射直接走vmmap,不使用task_vmmap
-void
-task_vmmap(struct task* t, u64 va, u64 pa, u64 size, u16 attr, enum vma_type type)
+/*
+  登记一个vma,地址空间的vma数达到NVMA_MAX时返回NULL
+  只有堆、mmap与munmap拆分会失败: ELF的段数在read_elfhdr中限制,fork复制的vma数与父进程相同
+*/
+struct vma*
+vma_add(struct task* t, u64 va, u64 pa, u64 size, u16 attr, enum vma_type type)
 {
+  if (t->mm_struct->nvma == NVMA_MAX)
+    return NULL;
+  ++t->mm_struct->nvma;
   struct vma* v = alloc_vma_slot();
   v->va = va;
   v->pa = pa;
   v->size = size;
   v->attr = attr;
   v->type = type;
+  v->file = NULL;
+  v->off = 0;
+  v->flags = 0;
   list_pushback(&t->mm_struct->vma_head, &v->node);
-  svmmap(t->pagetable, va, pa, size, attr, t);
+  return v;
+}
+
+// pa是否落在全局零页内
+bool
+is_zero_page(u64 pa)
+{
+  return align_down(pa, PGSIZE) == (u64)zero_page;
+}
+
+struct vma*
+vma_find(struct task* t, u64 va)
+{
+  struct list_node* node = t->mm_struct->vma_head.next;
+  while (node != &t->mm_struct->vma_head) {
+    struct vma* v = container_of(node, struct vma, node);
+    if (va >= v->va && va < v->va + v->size)
+      return v;
+    node = node->next;
+  }
+  return NULL;
+}
+
+/*
+  fork时父子进程共享MAP_SHARED映射的物理页: 页从所属地址空间的私有页链表上摘下,由share计数
+  调用方持有p所在地址空间的mm锁,share为0的页只会被该地址空间访问
+*/
+static void
+share_page(struct page* p)
+{
+  if (p->share == 0) {
+    list_remove(&p->page_node);
+    list_init(&p->page_node);
+    p->share = 1;
+  }
+  __sync_fetch_and_add(&p->share, 1);
+}
+
+// 解除一个用户页的映射,共享页只在最后一个地址空间解除映射时释放;要释放的页放入freed
+static void
+put_user_page(struct page* p, struct list_node* freed)
+{
+  if (p->share == 0)
+    list_remove(&p->page_node);
+  else if (__sync_sub_and_fetch(&p->share, 1))
+    return;
+  list_pushback(freed, &p->page_node);
+}
+
+/*
+  刷新使用地址空间mm的所有cpu的TLB,mm为NULL时只刷新本cpu
+  内核运行在内核页表上,只有在用户态运行mm中其他线程的cpu可能缓存旧的页表项: 向它们发送核间中断,
+  陷入内核时trampoline中的sfence.vma即清空其TLB,返回用户态前还会再刷新一次;ipi_seq变化说明已经陷入过内核
+  等待时不能持有自旋锁: 目标cpu可能正关中断等待本cpu持有的锁;持有自旋锁时(console_read中写零页)只发送不等待,
+  此时没有物理页被释放,目标最迟在下一次陷入时刷新
+*/
+static void
+tlb_shootdown(struct mm_struct* mm)
+{
+  extern struct cpu cpus[NCPU];
+  asm volatile("sfence.vma zero, zero");
+  if (mm == NULL || mm->ref <= 1) // 没有其他线程,退出时已降为0
+    return;
+  u64 seq[NCPU], targets = 0;
+  __sync_synchronize(); //! 先让页表项的修改可见,再判断哪些cpu在运行mm
+  for (int i = 0; i < NCPU; ++i) {
+    struct task* cur = cpus[i].cur_task;
+    if (cur == NULL || cur == mytask() || cur->mm_struct != mm)
+      continue;
+    seq[i] = cpus[i].ipi_seq;
+    targets |= CPU_BIT(i);
+    send_ipi(i);
+  }
+  if (mycpu()->spinlevel)
+    return;
+  for_each_cpu(i, targets)
+    while (*(volatile u64*)&cpus[i].ipi_seq == seq[i])
+      ;
+}
+
+// 刷新TLB后才释放解除映射的页: 在此之前其他cpu上的线程仍可能通过旧的TLB项读写它们
+static void
+flush_and_free(struct mm_struct* mm, struct list_node* freed)
+{
+  tlb_shootdown(mm);
+  while (freed->next != freed) {
+    struct page* p = container_of(freed->next, struct page, page_node);
+    list_remove(&p->page_node);
+    free_page(p);
+  }
+}
+
+/*
+  解除ptb(第level级页表)中[va,bound)范围的映射,返回该页表是否已经全空
+  ut非空时把叶子物理页和变空的下级页表页从ut的私有页链表摘下,放入freed
+  nleaf累加被释放的叶子物理页数,由调用方更新对应vma类型的rss
+  ! 不刷新TLB,由调用方在整个范围处理完后经flush_and_free统一刷新并释放
+*/
+static bool
+do_vmunmap(pagetable_t ptb, u64 va, u64 bound, i8 level, struct task* ut, u32* nleaf, struct list_node* freed)
+{
+  u64 span = PGSIZE << (9 * level); // 该级每个pte覆盖的地址范围
+  while (va < bound) {
+    u64 next = min(align_down(va, span) + span, bound);
+    pte_t* pte = &ptb[va_level(va, level)];
+    if (*pte & PTE_V) {
+      u64 pa = (*pte >> 10) << 12;
+      if (*pte & (PTE_R | PTE_W | PTE_X)) { // 叶子pte,用户页表中只有4KB页
+        if (ut && pa != (u64)zero_page) {
+          put_user_page(page(pa), freed);
+          ++*nleaf;
+        }
+        *pte = 0;
+      } else if (do_vmunmap((pagetable_t)pa, va, next, level - 1, ut, nleaf, freed) && ut) {
+        list_remove(&page(pa)->page_node);
+        list_pushback(freed, &page(pa)->page_node);
+        --ut->mm_struct->nptable;
+        *pte = 0;
+      }
+    }
+    va = next;
+  }
+
+  if (ut == NULL)
+    return false;
+  for (int i = 0; i < 512; ++i)
+    if (ptb[i] & PTE_V)
+      return false;
+  return true;
 }
 
 void
-vmunmap(pagetable_t ptb, u64 va, u64 size) //! 只考虑了4KB的页
+vmunmap(pagetable_t ptb, u64 va, u64 size, struct task* ut)
 {
   if (va % PGSIZE)
     panic("vmunmap: not aligned");
   if (va + size > VA_TOP)
     panic("vmunmap: out of range");
+  u32 nleaf = 0;
+  struct list_node freed;
+  list_init(&freed);
+  do_vmunmap(ptb, va, align_up(va + size, PGSIZE), 2, ut, &nleaf, &freed);
+  flush_and_free(ut ? ut->mm_struct : NULL, &freed);
+}
 
-  u64 bound = align_up(va + size, PGSIZE);
+// 共享文件映射[va,bound)范围内的脏页(已被写入过的页才会拥有PTE_W)回写到文件
+static void
+mmap_sync(struct task* t, struct vma* v, u64 va, u64 bound)
+{
+  if ((v->flags & MAP_SHARED) == 0)
+    return;
+  pte_t* pte;
   for (; va < bound; va += PGSIZE) {
-    pte_t *cur = (pte_t*)ptb, *pte;
-    i8 level;
+    u64 pa = va_to_pa(t->pagetable, va, &pte);
+    if (pa && (*pte & PTE_W))
+      fpwrite(v->file, (void*)pa, v->off + (va - v->va), PGSIZE);
+  }
+}
 
-    for (level = 2; level >= 0; --level) {
-      u64 vpn = va_level(va, level);
-      pte = &cur[vpn];
+// 解除vma中[va,bound)的映射,要释放的物理页放入freed,不刷新TLB
+static void
+vma_unmap(struct task* t, struct vma* v, u64 va, u64 bound, struct list_node* freed)
+{
+  if (v->type == MMAP)
+    mmap_sync(t, v, va, bound);
+  u32 nleaf = 0;
+  do_vmunmap(t->pagetable, va, bound, 2, t, &nleaf, freed);
+  t->mm_struct->rss[v->type] -= nleaf;
+}
 
-      if (! (*pte & PTE_V))
-        break;
+static void
+vma_remove(struct task* t, struct vma* v)
+{
+  if (v->type == MMAP)
+    fclose(v->file);
+  list_remove(&v->node);
+  free_vma_slot(v);
+  --t->mm_struct->nvma;
+}
 
-      if (level == 0) {
-        *pte = 0;
-        break;
+// 解除vma的全部映射,释放其物理页和变空的页表页
+void
+vma_free(struct task* t, struct vma* v)
+{
+  struct list_node freed;
+  list_init(&freed);
+  vma_unmap(t, v, v->va, v->va + v->size, &freed);
+  vma_remove(t, v);
+  flush_and_free(t->mm_struct, &freed);
+}
+
+/*
+  解除当前进程[va,va+size)的映射,范围可以跨越多个vma,也可以只覆盖vma的一部分
+  只允许解除堆区和文件映射区,返回false表示范围内有其他类型的vma,或从中间挖空时vma数已达上限
+  所有页处理完后只刷新一次TLB,刷新后才释放物理页
+*/
+bool
+task_vmunmap(struct task* t, u64 va, u64 size)
+{
+  u64 bound = align_up(va + size, PGSIZE);
+  struct list_node* head = &t->mm_struct->vma_head;
+  struct list_node* node;
+  struct vma *v, *n = NULL;
+  struct list_node freed;
+  list_init(&freed);
+
+  for (node = head->next; node != head; node = node->next) {
+    v = container_of(node, struct vma, node);
+    if (v->va < bound && va < v->va + v->size && v->type != HEAP && v->type != MMAP)
+      return false;
+  }
+  for (node = head->next; node != head; node = node->next) {
+    v = container_of(node, struct vma, node);
+    if (v->va < va && bound < v->va + v->size) { // 从中间挖空,在解除任何映射之前先登记尾部拆出的vma
+      n = vma_add(t, bound, 0, v->va + v->size - bound, v->attr, v->type);
+      if (n == NULL)
+        return false;
+      break;
+    }
+  }
+
+  node = head->next;
+  while (node != head) {
+    v = container_of(node, struct vma, node);
+    node = node->next;
+    u64 vend = v->va + v->size;
+    if (vend <= va || bound <= v->va)
+      continue;
+
+    u64 s = max(va, v->va), e = min(bound, vend);
+    vma_unmap(t, v, s, e, &freed);
+    if (s == v->va && e == vend) {
+      vma_remove(t, v);
+      continue;
+    }
+    if (s > v->va && e < vend) { // 从中间挖空,尾部为预先登记的n
+      if (v->type == MMAP) {
+        fdup(v->file);
+        n->file = v->file;
+        n->off = v->off + (e - v->va);
+        n->flags = v->flags;
       }
-      cur = (pte_t*)((*pte >> 10) << 12);
     }
+    if (s == v->va) { // 解除了头部
+      v->off += e - v->va;
+      v->size = vend - e;
+      v->va = e;
+    } else // 解除了尾部(中间挖空时尾部已经拆出)
+      v->size = s - v->va;
+    v->pa = 0;
   }
 
-  asm volatile("sfence.vma zero, zero");
+  flush_and_free(t->mm_struct, &freed);
+  return true;
+}
+
+//! trampoline,trapframe页的映射直接走vmmap,不使用task_vmmap
+void
+task_vmmap(struct task* t, u64 va, u64 pa, u64 size, u16 attr, enum vma_type type)
+{
+  vma_add(t, va, pa, size, attr, type);
+  svmmap(t->pagetable, va, pa, size, attr, t);
+  t->mm_struct->rss[type] += align_up(size, PGSIZE) / PGSIZE;
+}
+
+// 在vma v中映射一个用户页并计入rss
+void
+task_map_page(struct task* t, struct vma* v, u64 va, u64 pa, u16 attr)
+{
+  svmmap(t->pagetable, va, pa, PGSIZE, attr, t);
+  if (pa != (u64)zero_page)
+    ++t->mm_struct->rss[v->type];
 }
 
+static bool mmap_fault(struct task* t, struct vma* v, u64 va, bool write);
+
+/*
+  逐页拷贝父进程已载入的页,尚未载入的页留给子进程自己缺页处理
+  MAP_SHARED映射不拷贝: 父进程先载入全部页,父子映射同一物理页,任一方的写入对另一方可见,回写的也是同一页
+*/
 void
 copy_pagetable(struct task* c, struct task* p)
 {
-  struct vma* pvm;
-  struct page* page;
+  struct vma *pvm, *cvm;
+  pte_t* pte;
   struct list_node* node = p->mm_struct->vma_head.next;
 
   while (node != &p->mm_struct->vma_head) {
     pvm = container_of(node, struct vma, node);
-    page = alloc_page_for_task(c);
-    memcpy((void*)page->paddr, (void*)pvm->pa, PGSIZE);
-    task_vmmap(c, pvm->va, page->paddr, pvm->size, pvm->attr, pvm->type);
+    cvm = vma_add(c, pvm->va, 0, pvm->size, pvm->attr, pvm->type);
+    if (pvm->type == MMAP) {
+      fdup(pvm->file);
+      cvm->file = pvm->file;
+      cvm->off = pvm->off;
+      cvm->flags = pvm->flags;
+    }
+    bool shared = pvm->type == MMAP && (pvm->flags & MAP_SHARED);
+    for (u64 va = pvm->va; va < pvm->va + pvm->size; va += PGSIZE) {
+      u64 pa = va_to_pa(p->pagetable, va, &pte);
+      if (pa == 0 && shared && mmap_fault(p, pvm, va, false))
+        pa = va_to_pa(p->pagetable, va, &pte);
+      if (pa == 0)
+        continue;
+      if (pa == (u64)zero_page) {
+        task_map_page(c, cvm, va, pa, *pte & (PTE_R | PTE_X | PTE_U));
+        continue;
+      }
+      u64 npa = pa;
+      if (shared)
+        share_page(page(pa));
+      else {
+        struct page* np = alloc_page_for_task(c);
+        memcpy((void*)np->paddr, (void*)pa, PGSIZE);
+        npa = np->paddr;
+      }
+      task_map_page(c, cvm, va, npa, *pte & (PTE_R | PTE_W | PTE_X | PTE_U));
+      if (va == pvm->va)
+        cvm->pa = npa;
+      preempt_point(); // 复制大进程耗时较长
+    }
     node = node->next;
   }
 }
@@ -232,43 +520,145 @@ va_to_pa(pagetable_t ptb, u64 va, pte_t** p) // ?目前只适用于4KB页
   return (ppn << 12) | offset;
 }
 
+static bool
+mmap_fault(struct task* t, struct vma* v, u64 va, bool write)
+{
+  if (! intr() && mycpu()->spinlevel) //! 从文件载入页会阻塞,持有自旋锁时不能进行(开中断时必未持有)
+    return false;
+  struct page* p = alloc_page_for_task(t);
+  fpread(v->file, (void*)p->paddr, v->off + (va - v->va), PGSIZE);
+  u16 attr = v->attr;
+  if ((v->flags & MAP_SHARED) && ! write)
+    attr &= ~PTE_W; // 首次写入时再授予写权限,以此区分脏页
+  task_map_page(t, v, va, p->paddr, attr);
+  return true;
+}
 
-void
-copy_to_user(void* udst, const void* ksrc, u32 bytes)
+// 匿名内存(堆,数据段,栈)缺页: 读映射全局零页,写才分配私有页
+static bool
+anon_fault(struct task* t, struct vma* v, u64 va, bool write)
 {
-  u32 pend_bytes = bytes;
-  u64 ud = (u64)udst, kd = (u64)ksrc;
+  if (! write) {
+    task_map_page(t, v, va, (u64)zero_page, v->attr & ~PTE_W);
+    return true;
+  }
+  if (free_page_cnt() == 0)
+    return false;
+  struct page* p = alloc_page_for_task(t);
+  task_map_page(t, v, va, p->paddr, v->attr);
+  return true;
+}
+
+/*
+  处理当前进程在用户地址va处的缺页或写保护异常
+  返回false表示非法访问,由调用方决定是否kill
+*/
+static bool
+handle_fault(u64 va, bool write)
+{
+  struct task* t = mytask();
+  struct vma* v = vma_find(t, va);
+  if (v == NULL || (write && (v->attr & PTE_W) == 0))
+    return false;
 
-  u32 len;
   pte_t* pte;
-  u64 paddr;
-  while (pend_bytes) {
-    len = min((align_up(ud + 1, PGSIZE) - ud), pend_bytes);
-    paddr = va_to_pa(mytask()->pagetable, ud, &pte);
+  va = align_down(va, PGSIZE);
+  u64 pa = va_to_pa(t->pagetable, va, &pte);
+  if (pa) {
+    if (! write || (*pte & PTE_W))
+      return false;
+    if (pa == (u64)zero_page) { // 写零页: 换成私有页
+      if (free_page_cnt() == 0)
+        return false;
+      struct page* p = alloc_page_for_task(t);
+      *pte = ((p->paddr >> 12) << 10) | PTE_V | v->attr;
+      ++t->mm_struct->rss[v->type];
+      tlb_shootdown(t->mm_struct); // 其他线程可能仍缓存着指向零页的旧页表项,会读到零而看不到写入
+    } else {
+      *pte |= PTE_W | PTE_D; // 只增加权限,旧的只读项最多再引发一次写保护异常
+      asm volatile("sfence.vma zero, zero");
+    }
+    return true;
+  }
+
+  switch (v->type) {
+  case MMAP:
+    return mmap_fault(t, v, va, write);
+  case HEAP:
+  case DATA:
+  case STACK:
+    return anon_fault(t, v, va, write);
+  default:
+    return false;
+  }
+}
+
+// 线程共享地址空间,缺页处理需持有mm锁;持有自旋锁时(如console_read)不能睡眠,此时不加锁
+bool
+do_page_fault(u64 va, bool write)
+{
+  struct mm_struct* mm = mytask()->mm_struct;
+  bool lock = mycpu()->spinlevel == 0;
+  if (lock)
+    sleep_get(&mm->lock);
+  bool r = handle_fault(va, write);
+  if (lock)
+    sleep_put(&mm->lock);
+  return r;
+}
+
+// 不触发缺页地拷贝到用户空间,遇到未映射或不可写的页即停止,返回已拷贝的字节数;持有块缓存等睡眠锁时使用
+u32
+copy_to_user_nofault(void* udst, const void* ksrc, u32 bytes)
+{
+  u64 ud = (u64)udst, kd = (u64)ksrc;
+  u32 done = 0;
+  pte_t* pte;
+  while (done < bytes) {
+    u32 len = min((align_up(ud + 1, PGSIZE) - ud), bytes - done);
+    u64 paddr = va_to_pa(mytask()->pagetable, ud, &pte);
     if (paddr == 0 || ((*pte) & (PTE_W | PTE_U)) != (PTE_W | PTE_U))
-      kill();
+      break;
     memcpy((void*)paddr, (void*)kd, len);
-    ud += len, kd += len, pend_bytes -= len;
+    ud += len, kd += len, done += len;
   }
+  return done;
 }
 
-void
-copy_from_user(void* kdst, const void* usrc, u32 bytes)
+// 不触发缺页地从用户空间拷贝,遇到未映射或不可读的页即停止,返回已拷贝的字节数
+u32
+copy_from_user_nofault(void* kdst, const void* usrc, u32 bytes)
 {
-  u32 pend_bytes = bytes;
   u64 kd = (u64)kdst, us = (u64)usrc;
-
-  u32 len;
+  u32 done = 0;
   pte_t* pte;
-  u64 paddr;
-  while (pend_bytes > 0) {
-    len = min((align_up(us + 1, PGSIZE) - us), pend_bytes);
-    paddr = va_to_pa(mytask()->pagetable, us, &pte);
+  while (done < bytes) {
+    u32 len = min((align_up(us + 1, PGSIZE) - us), bytes - done);
+    u64 paddr = va_to_pa(mytask()->pagetable, us, &pte);
     if (paddr == 0 || ((*pte) & (PTE_R | PTE_U)) != (PTE_R | PTE_U))
-      kill();
+      break;
     memcpy((void*)kd, (void*)paddr, len);
-    kd += len, us += len, pend_bytes -= len;
+    kd += len, us += len, done += len;
   }
+  return done;
+}
+
+void
+copy_to_user(void* udst, const void* ksrc, u32 bytes)
+{
+  u32 done = 0;
+  while ((done += copy_to_user_nofault(udst + done, ksrc + done, bytes - done)) < bytes)
+    if (! do_page_fault((u64)udst + done, true))
+      kill();
+}
+
+void
+copy_from_user(void* kdst, const void* usrc, u32 bytes)
+{
+  u32 done = 0;
+  while ((done += copy_from_user_nofault(kdst + done, usrc + done, bytes - done)) < bytes)
+    if (! do_page_fault((u64)usrc + done, false))
+      kill();
 }
 
 void
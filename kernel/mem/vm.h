@@ -1,6 +1,27 @@
 #pragma once
+
+// mmap的保护属性与映射方式
+enum prot {
+  PROT_READ = 0b1,
+  PROT_WRITE = 0b10,
+  PROT_EXEC = 0b100,
+};
+enum map_flag {
+  MAP_SHARED = 0b1,   // 写入会回写到文件
+  MAP_PRIVATE = 0b10, // 写入仅对当前进程可见
+};
+
+// 进程常驻内存统计(页数),全局零页不计入
+struct memstat {
+  unsigned int text, data, heap, stack, mmap; // 各类vma的用户页
+  unsigned int pgtable;                       // 页表页(含根页表)
+  unsigned int kstack;                        // 内核栈与trapframe页
+};
+
+#ifndef USER
 #include "types.h"
 #include "util/list.h"
+#include "util/sleeplock.h"
 
 #define S_PAGE 0 // 4KB
 #define M_PAGE 1 // 2MB
@@ -11,19 +32,35 @@ enum vma_type {
   HEAP,
   TEXT,
   DATA,
+  MMAP, // 文件映射,缺页时从文件载入
+  NVMA_TYPE,
 };
+struct file;
 struct vma {
   struct list_node node;
   u64 va, pa, size;
   enum vma_type type;
   u16 attr;
+
+  // 仅MMAP使用
+  struct file* file;
+  u32 off;
+  enum map_flag flags;
 };
 
 struct task;
 void svmmap(pagetable_t ptb, u64 va, u64 pa, u64 size, u16 attr, struct task* ut);
 void mvmmap(pagetable_t ptb, u64 va, u64 pa, u64 size, u16 attr); //! 暂时只能由内核调用
 void task_vmmap(struct task* t, u64 va, u64 pa, u64 size, u16 attr, enum vma_type type);
-void vmunmap(pagetable_t ptb, u64 va, u64 size);
+void task_map_page(struct task* t, struct vma* v, u64 va, u64 pa, u16 attr);
+void vmunmap(pagetable_t ptb, u64 va, u64 size, struct task* ut);
+bool task_vmunmap(struct task* t, u64 va, u64 size);
+
+struct vma* vma_add(struct task* t, u64 va, u64 pa, u64 size, u16 attr, enum vma_type type);
+struct vma* vma_find(struct task* t, u64 va);
+void vma_free(struct task* t, struct vma* v);
+bool do_page_fault(u64 va, bool write);
+bool is_zero_page(u64 pa);
 
 void copy_pagetable(struct task* c, struct task* p);
 void scan_pagetable(pagetable_t ptb);
@@ -31,9 +68,21 @@ void scan_pagetable(pagetable_t ptb);
 u64 va_to_pa(pagetable_t ptb, u64 va, pte_t** p);
 void copy_to_user(void* udst, const void* ksrc, u32 bytes);
 void copy_from_user(void* kdst, const void* usrc, u32 bytes);
+u32 copy_to_user_nofault(void* udst, const void* ksrc, u32 bytes);
+u32 copy_from_user_nofault(void* kdst, const void* usrc, u32 bytes);
 
 struct mm_struct {
   struct list_node vma_head;
   struct list_node page_head;
   u64 next_heap;
-};
\ No newline at end of file
+  u64 next_mmap;
+  u32 ref;               // 共享该地址空间的任务数(进程及其线程)
+  struct sleeplock lock; // 保护vma链表与页表,线程间可能并发缺页、mmap与munmap
+
+  // 常驻内存统计,在每次映射与解除映射时更新
+  u32 rss[NVMA_TYPE]; // 按vma类型统计的用户页
+  u32 nptable;        // 页表页
+  u32 nkstack;        // 内核栈与trapframe页
+  u32 nvma;           // vma数,不超过NVMA_MAX
+};
+#endif
@@ -9,7 +9,12 @@ static syscall_t syscalls[] = {
   [SYS_WRITE] sys_write, [SYS_LSEEK] sys_lseek,   [SYS_OPEN] sys_open,   [SYS_DUP] sys_dup,     [SYS_CLOSE] sys_close,
   [SYS_LINK] sys_link,   [SYS_UNLINK] sys_unlink, [SYS_MKDIR] sys_mkdir, [SYS_RMDIR] sys_rmdir, [SYS_MKNOD] sys_mknod,
   [SYS_CHDIR] sys_chdir, [SYS_ALLOC] sys_alloc,   [SYS_FREE] sys_free,   [SYS_PIPE] sys_pipe,   [SYS_LS] sys_ls,
-  [SYS_SLEEP] sys_sleep,
+  [SYS_SLEEP] sys_sleep, [SYS_MMAP] sys_mmap,     [SYS_MUNMAP] sys_munmap, [SYS_SBRK] sys_sbrk,
+  [SYS_MEMSTAT] sys_memstat, [SYS_SETPRIORITY] sys_setpriority, [SYS_NANOSLEEP] sys_nanosleep,
+  [SYS_SCHED_SETAFFINITY] sys_sched_setaffinity, [SYS_SCHED_GETAFFINITY] sys_sched_getaffinity,
+  [SYS_THREAD] sys_thread, [SYS_JOIN] sys_join, [SYS_FUTEX_WAIT] sys_futex_wait, [SYS_FUTEX_WAKE] sys_futex_wake,
+  [SYS_SCHEDSTAT] sys_schedstat, [SYS_VLEN] sys_vlen, [SYS_SPAWN] sys_spawn,
+  [SYS_SCHED_SETSCHEDULER] sys_sched_setscheduler,
 };
 
 
@@ -29,6 +34,8 @@ argstr(u64 uaddr, char* path)
   extern void kill(void);
   pte_t* pte;
   u64 paddr = va_to_pa(mytask()->pagetable, uaddr, &pte);
+  if (paddr == 0 && do_page_fault(uaddr, false))
+    paddr = va_to_pa(mytask()->pagetable, uaddr, &pte);
   if (paddr == 0 || ((*pte) & (PTE_U | PTE_R)) != (PTE_U | PTE_R))
     kill();
   int len = strlen((char*)paddr);
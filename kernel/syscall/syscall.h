@@ -1,27 +1,42 @@
 #pragma once
 #ifndef USER
-#define SYS_FORK   0
-#define SYS_EXIT   1
-#define SYS_EXEC   2
-#define SYS_WAIT   3
-#define SYS_READ   4
-#define SYS_WRITE  5
-#define SYS_LSEEK  6
-#define SYS_OPEN   7
-#define SYS_DUP    8
-#define SYS_CLOSE  9
-#define SYS_LINK   10
-#define SYS_UNLINK 11
-#define SYS_MKDIR  12
-#define SYS_RMDIR  13
-#define SYS_MKNOD  14
-#define SYS_CHDIR  15
-#define SYS_ALLOC  16
-#define SYS_FREE   17
-#define SYS_PIPE   18
-#define SYS_LS     19
-#define SYS_THREAD 20
-#define SYS_SLEEP  21
+#define SYS_FORK               0
+#define SYS_EXIT               1
+#define SYS_EXEC               2
+#define SYS_WAIT               3
+#define SYS_READ               4
+#define SYS_WRITE              5
+#define SYS_LSEEK              6
+#define SYS_OPEN               7
+#define SYS_DUP                8
+#define SYS_CLOSE              9
+#define SYS_LINK               10
+#define SYS_UNLINK             11
+#define SYS_MKDIR              12
+#define SYS_RMDIR              13
+#define SYS_MKNOD              14
+#define SYS_CHDIR              15
+#define SYS_ALLOC              16
+#define SYS_FREE               17
+#define SYS_PIPE               18
+#define SYS_LS                 19
+#define SYS_THREAD             20
+#define SYS_SLEEP              21
+#define SYS_MMAP               22
+#define SYS_MUNMAP             23
+#define SYS_SBRK               24
+#define SYS_MEMSTAT            25
+#define SYS_SETPRIORITY        26
+#define SYS_NANOSLEEP          27
+#define SYS_SCHED_SETAFFINITY  28
+#define SYS_SCHED_GETAFFINITY  29
+#define SYS_JOIN               30
+#define SYS_FUTEX_WAIT         31
+#define SYS_FUTEX_WAKE         32
+#define SYS_SCHEDSTAT          33
+#define SYS_VLEN               34
+#define SYS_SPAWN              35
+#define SYS_SCHED_SETSCHEDULER 36
 
 #ifndef AS
 struct pt_regs;
@@ -50,6 +65,21 @@ long sys_pipe(struct pt_regs* pt);
 long sys_ls(struct pt_regs* pt);
 long sys_thread(struct pt_regs* pt);
 long sys_sleep(struct pt_regs* pt);
+long sys_mmap(struct pt_regs* pt);
+long sys_munmap(struct pt_regs* pt);
+long sys_sbrk(struct pt_regs* pt);
+long sys_memstat(struct pt_regs* pt);
+long sys_setpriority(struct pt_regs* pt);
+long sys_nanosleep(struct pt_regs* pt);
+long sys_sched_setaffinity(struct pt_regs* pt);
+long sys_sched_getaffinity(struct pt_regs* pt);
+long sys_join(struct pt_regs* pt);
+long sys_futex_wait(struct pt_regs* pt);
+long sys_futex_wake(struct pt_regs* pt);
+long sys_schedstat(struct pt_regs* pt);
+long sys_vlen(struct pt_regs* pt);
+long sys_spawn(struct pt_regs* pt);
+long sys_sched_setscheduler(struct pt_regs* pt);
 
 #endif
 #endif
\ No newline at end of file
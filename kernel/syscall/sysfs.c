@@ -6,6 +6,7 @@
 #include "fs/bio.h"
 #include "fs/pipe.h"
 #include "task/task.h"
+#include "task/sche.h"
 #include "trap/pt_reg.h"
 #include "util/string.h"
 #include "util/printf.h"
@@ -394,6 +395,7 @@ sys_ls(struct pt_regs*)
       ++dt;
     }
     brelse(b);
+    preempt_point();
   }
   print("\n", name);
   return 0;
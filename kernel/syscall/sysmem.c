@@ -2,20 +2,62 @@
 #include "trap/pt_reg.h"
 #include "mem/alloc.h"
 #include "mem/slot.h"
+#include "fs/file.h"
+
+// 堆区增长npage页,返回增长前的堆顶,失败返回0
+// 只登记vma,物理页在首次访问时由缺页异常分配(读访问映射全局零页)
+// 紧接在原堆顶之后的堆vma直接扩展,反复sbrk不会增加vma数
+static u64
+grow_heap(struct task* t, u64 npage)
+{
+  struct mm_struct* mm = t->mm_struct;
+  sleep_get(&mm->lock);
+  u64 va = mm->next_heap, size = npage * PGSIZE;
+  if (npage == 0 || va + size > MMAP_BASE) { // 物理页按需分配,不按当前空闲页数限制预留
+    sleep_put(&mm->lock);
+    return 0;
+  }
+  struct vma* v = va ? vma_find(t, va - 1) : NULL;
+  if (v && v->type == HEAP && v->va + v->size == va)
+    v->size += size;
+  else if (vma_add(t, va, 0, size, PTE_U | PTE_W | PTE_R, HEAP) == NULL) {
+    sleep_put(&mm->lock);
+    return 0;
+  }
+  mm->next_heap += size;
+  sleep_put(&mm->lock);
+  return va;
+}
+
+static long
+unmap_locked(u64 va, u64 len)
+{
+  struct task* t = mytask();
+  sleep_get(&t->mm_struct->lock);
+  bool ok = task_vmunmap(t, va, len);
+  sleep_put(&t->mm_struct->lock);
+  return ok ? 0 : -1;
+}
 
 long
 sys_alloc(struct pt_regs*)
+{
+  return grow_heap(mytask(), 1);
+}
+
+// sbrk(n): 堆区增长n字节(向上取整到页),n为0时返回当前堆顶
+long
+sys_sbrk(struct pt_regs* pt)
 {
   struct task* t = mytask();
-  if (t->mm_struct->next_heap == USTACK)
-    return 0;
-  struct page* p = alloc_page_for_task(t);
-  u16 attr = PTE_U | PTE_W | PTE_R;
-  task_vmmap(t, t->mm_struct->next_heap, p->paddr, PGSIZE, attr, HEAP);
-  long r = t->mm_struct->next_heap;
-  t->mm_struct->next_heap += PGSIZE;
-  return r;
+  long n = pt->a0;
+  if (n == 0)
+    return t->mm_struct->next_heap;
+  if (n < 0)
+    return 0; // 收缩堆区使用munmap
+  return grow_heap(t, align_up((u64)n, PGSIZE) / PGSIZE);
 }
+
 long
 sys_free(struct pt_regs* pt)
 {
@@ -23,15 +65,77 @@ sys_free(struct pt_regs* pt)
     return -1;
   if (pt->a0 % PGSIZE)
     return -1;
+  return unmap_locked(pt->a0, PGSIZE);
+}
+
+long
+sys_munmap(struct pt_regs* pt)
+{
+  u64 va = pt->a0, len = pt->a1;
+  if (va == 0 || va % PGSIZE || len == 0 || va + len > USTACK)
+    return -1;
+  return unmap_locked(va, len);
+}
+
+/*
+  将文件fd自off(页对齐)起len字节映射到进程地址空间的文件映射区
+  映射时不读取文件,由缺页异常逐页载入
+  成功返回映射起始地址,失败返回0
+*/
+long
+sys_mmap(struct pt_regs* pt)
+{
+  int fd = pt->a0, prot = pt->a3, flags = pt->a4;
+  u32 off = pt->a1, len = pt->a2;
   struct task* t = mytask();
-  struct list_node* node = t->mm_struct->vma_head.next;
-  while (node != &t->mm_struct->vma_head) {
-    struct vma* vma = container_of(node, struct vma, node);
-    node = node->next;
-    if (vma->type == HEAP && vma->pa == pt->a0) {
-      list_remove(&vma->node);
-      free_vma_slot(vma);
-    }
+  if (fd < 0 || fd >= NFILE || len == 0 || off % PGSIZE)
+    return 0;
+  struct file* f = t->fs_struct->files[fd];
+  if (f == NULL || f->type != INODE)
+    return 0;
+  if (((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return 0; // 必须且只能选择一种映射方式
+  if ((prot & PROT_READ) && (f->mode & O_RDONLY) == 0 && (f->mode & O_RDWR) == 0)
+    return 0;
+  if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && (f->mode & O_WRONLY) == 0 && (f->mode & O_RDWR) == 0)
+    return 0;
+
+  u16 attr = PTE_U;
+  if (prot & PROT_READ)
+    attr |= PTE_R;
+  if (prot & PROT_WRITE)
+    attr |= PTE_W;
+  if (prot & PROT_EXEC)
+    attr |= PTE_X;
+
+  struct mm_struct* mm = t->mm_struct;
+  u64 size = align_up((u64)len, PGSIZE);
+  sleep_get(&mm->lock);
+  if (mm->next_mmap + size > USTACK) {
+    sleep_put(&mm->lock);
+    return 0;
   }
-  return -1;
-}
\ No newline at end of file
+  struct vma* v = vma_add(t, mm->next_mmap, 0, size, attr, MMAP);
+  if (v == NULL) {
+    sleep_put(&mm->lock);
+    return 0;
+  }
+  fdup(f);
+  v->file = f;
+  v->off = off;
+  v->flags = flags;
+  mm->next_mmap += size;
+  sleep_put(&mm->lock);
+  return v->va;
+}
+
+// memstat(pid,ms): 获取进程pid的常驻内存统计,pid为0表示当前进程
+long
+sys_memstat(struct pt_regs* pt)
+{
+  struct memstat ms;
+  if (pt->a1 == 0 || ! task_memstat(pt->a0, &ms))
+    return -1;
+  copy_to_user((void*)pt->a1, &ms, sizeof(ms));
+  return 0;
+}
@@ -6,8 +6,9 @@
 #include "task/sche.h"
 #include "mem/vm.h"
 #include "task/elf.h"
+#include "task/timer.h"
+#include "task/futex.h"
 
-extern void context_switch(struct context* old, struct context* new);
 extern void first_sched(void);
 
 long
@@ -26,9 +27,12 @@ sys_fork(struct pt_regs*)
     u64 sp;
     asm volatile("mv %0, sp" : "=r"(sp));
     c->ctx.sp = c->kstack - (p->kstack - sp);
-    c->state = READY;
+    spin_get(&c->lock);
+    task_ready(c);
+    spin_put(&c->lock);
     return c->pid;
   } else {
+    finish_switch();
     spin_put(&mytask()->lock);
     return 0;
   }
@@ -37,31 +41,35 @@ sys_fork(struct pt_regs*)
 long
 sys_exit(struct pt_regs* pt)
 {
-  extern struct task task_queue[NPROC];
   struct task* t = mytask();
   t->exit_code = pt->a0;
+  if (! is_thread(t))
+    exit_threads(t);
+  orphan_childs(t);
 
-  struct list_node* child = t->childs.next; // 孤儿进程交给init
-  while (child != &t->childs) {
-    struct task* c = container_of(child, struct task, self);
-    child = child->next;
-    spin_get(&c->lock);
-    c->parent = &task_queue[0];
-    list_remove(&c->self);
-    list_pushback(&task_queue[0].childs, &c->self);
-    spin_put(&c->lock);
-  }
-
+  preempt_disable(); //! clean_source会释放仍在使用的内核栈页
   clean_source(t);
 
+  spin_get(&wait_lock);
+  wakeup(is_thread(t) ? (void*)t : &t->parent->childs); // 线程由join等待
+  spin_get(&t->lock); //! 父进程在wait中获取t->lock后才回收,保证此时已切换离开
   t->state = EXIT;
-  wakeup(&t->parent->childs);
-
-  spin_get(&t->lock);
-  context_switch(&t->ctx, &mycpu()->ctx);
+  spin_put(&wait_lock);
+  preempt_enable(); // 持有t->lock,不会被抢占
+  schedule(t, false);
   return 0;
 }
 
+// 任务名取可执行文件路径的最后一项
+static void
+set_tname(struct task* t, const char* path)
+{
+  int off = strlen(path);
+  while (off > 0 && path[off - 1] != '/')
+    --off;
+  strcpy(t->tname, path + off);
+}
+
 long
 sys_exec(struct pt_regs* pt)
 {
@@ -73,11 +81,12 @@ sys_exec(struct pt_regs* pt)
     if (f == NULL)
       return -1;
     struct task* t = mytask();
+    if (t->mm_struct->ref > 1) { // 地址空间仍被其他线程使用
+      fclose(f);
+      return -1;
+    }
 
-    int off = strlen(path);
-    while (off > 0 && path[off - 1] != '/')
-      --off;
-    strcpy(t->tname, path + off);
+    set_tname(t, path);
 
     if (pt->a1) {
       char option[MAX_PATH_LENGTH / 2] = { 0 };
@@ -87,18 +96,70 @@ sys_exec(struct pt_regs* pt)
       memcpy((void*)va_to_pa(t->pagetable, t->ustack, NULL), option, opsize);
     }
     reset_vma(t);
+    fp_release(t);
+    fp_init(t);
     load_segment(t, f, &eh);
     fclose(f);
     t->entry = eh.entry;
+    t->uarg = t->ustack == USTACK + PGSIZE ? 0 : t->ustack; // 没有选项参数时为0
     t->ctx.ra = (u64)first_sched;
     t->ctx.sp = t->kstack;
     spin_get(&t->lock);
     t->state = READY;
-    context_switch(NULL, &mycpu()->ctx);
+    schedule(t, false); // 不保存当前上下文,再次被调度时从first_sched开始
   }
   return -1;
 }
 
+/*
+  spawn(path, option, fds): 直接由可执行文件创建子进程,相当于fork后立即exec,但不复制父进程的地址空间
+  fds以-1结尾,子进程的文件i为父进程的文件fds[i];fds为NULL时继承全部文件(保持原文件号)
+*/
+long
+sys_spawn(struct pt_regs* pt)
+{
+  struct task* p = mytask();
+  char path[MAX_PATH_LENGTH / 2] = { 0 };
+  char option[MAX_PATH_LENGTH / 2] = { 0 };
+  struct file* sf[NFILE]; // 检查fds时即持有引用,read_elfhdr等待IO期间其他线程close也不影响
+  int nfd = 0;
+  argstr(pt->a0, path);
+  if (pt->a1)
+    argstr(pt->a1, option);
+
+  struct file** files = p->fs_struct->files;
+  bool ok = true;
+  while (pt->a2) {
+    int fd;
+    copy_from_user(&fd, (int*)pt->a2 + nfd, sizeof(int));
+    if (fd == -1)
+      break;
+    struct file* sfile = fd >= 0 && fd < NFILE ? files[fd] : NULL;
+    if (nfd == NFILE || sfile == NULL) {
+      ok = false;
+      break;
+    }
+    fdup(sfile);
+    sf[nfd++] = sfile;
+  }
+
+  struct elfhdr eh;
+  struct file* f = ok ? read_elfhdr(path, &eh) : NULL;
+  struct task* c = f ? alloc_spawn(p, f, &eh, pt->a1 ? option : NULL, pt->a2 ? sf : NULL, nfd) : NULL;
+  if (f)
+    fclose(f);
+  for (int i = 0; i < nfd; ++i)
+    fclose(sf[i]);
+  if (c == NULL)
+    return -1;
+  set_tname(c, path);
+  list_pushback(&p->childs, &c->self);
+  spin_get(&c->lock);
+  task_ready(c);
+  spin_put(&c->lock);
+  return c->pid;
+}
+
 long
 sys_wait(struct pt_regs* pt)
 {
@@ -106,30 +167,172 @@ sys_wait(struct pt_regs* pt)
   if (t->childs.next == &t->childs)
     return -1;
 
+  spin_get(&wait_lock); //! 检查子进程状态与睡眠之间不能被抢占,否则可能丢失子进程退出的唤醒
   while (1) {
     struct list_node* child = t->childs.next;
     while (child != &t->childs) {
       struct task* c = container_of(child, struct task, self);
       if (c->state == EXIT) {
         u16 cpid = c->pid;
+        int code = c->exit_code;
         list_remove(&c->self);
+        free_task(c);
+        spin_put(&wait_lock);
         if (pt->a0)
-          copy_to_user((void*)pt->a0, &c->exit_code, sizeof(c->exit_code));
-        c->state = FREE;
+          copy_to_user((void*)pt->a0, &code, sizeof(code));
         return cpid;
       }
       child = child->next;
     }
-    sleep(&t->childs, NULL);
+    if (! sleep_killable(&t->childs, &wait_lock)) {
+      spin_put(&wait_lock);
+      return -1;
+    }
+  }
+}
+
+// thread(fn,stack,arg): 创建共享地址空间与文件表的线程,从fn(arg)开始执行,栈顶为stack(16字节对齐)
+long
+sys_thread(struct pt_regs* pt)
+{
+  if (pt->a0 == 0 || pt->a1 == 0 || pt->a1 % 16 || pt->a1 > USTACK || mytask()->killed)
+    return -1;
+  struct task* t = alloc_thread(mytask(), pt->a0, pt->a1, pt->a2);
+  return t ? t->tid : -1;
+}
+
+// join(tid,code): 等待同一进程中的线程tid退出并回收,code非空时写入其退出码
+long
+sys_join(struct pt_regs* pt)
+{
+  struct task* t = mytask();
+  u16 tid = pt->a0;
+
+  spin_get(&wait_lock);
+  while (1) {
+    struct task* c = thread_find(t->pid, tid);
+    if (c == NULL || c == t) {
+      spin_put(&wait_lock);
+      return -1;
+    }
+    if (c->state == EXIT) {
+      int code = c->exit_code;
+      free_thread(c);
+      spin_put(&wait_lock);
+      if (pt->a1)
+        copy_to_user((void*)pt->a1, &code, sizeof(code));
+      return 0;
+    }
+    if (! sleep_killable(c, &wait_lock)) {
+      spin_put(&wait_lock);
+      return -1;
+    }
   }
 }
 
 long
 sys_sleep(struct pt_regs* pt)
 {
-  extern u64 tstub;
-  u64 texp = r_time() + pt->a0 * TIME_CYCLE;
-  while (tstub < texp)
-    sleep(&tstub, NULL);
+  sleep_until(r_time() + pt->a0 * TIME_CYCLE);
   return 0;
-}
\ No newline at end of file
+}
+
+// nanosleep(ns): 睡眠ns纳秒,精度为time寄存器的一个计数
+long
+sys_nanosleep(struct pt_regs* pt)
+{
+  u64 ns = pt->a0, unit = 1000000000UL / TIMEBASE_FREQ;
+  sleep_until(r_time() + (ns + unit - 1) / unit);
+  return 0;
+}
+
+// futex_wait(addr,val,ns): *addr等于val时睡眠,直到被futex_wake唤醒或超过ns纳秒(0表示不超时)
+long
+sys_futex_wait(struct pt_regs* pt)
+{
+  u64 ns = pt->a2, unit = 1000000000UL / TIMEBASE_FREQ;
+  return futex_wait(pt->a0, pt->a1, (ns + unit - 1) / unit);
+}
+
+// futex_wake(addr,n): 唤醒最多n个在addr上等待的任务,返回唤醒的个数
+long
+sys_futex_wake(struct pt_regs* pt)
+{
+  return futex_wake(pt->a0, pt->a1);
+}
+
+// schedstat(pid,st): 获取进程pid(0表示当前进程)的调度统计与全局唤醒延迟直方图
+long
+sys_schedstat(struct pt_regs* pt)
+{
+  struct schedstat st;
+  if (pt->a1 == 0 || ! task_schedstat(pt->a0, &st))
+    return -1;
+  copy_to_user((void*)pt->a1, &st, sizeof(st));
+  return 0;
+}
+
+// vlen(): 向量寄存器位宽(bit),不支持V扩展时为0
+long
+sys_vlen(struct pt_regs*)
+{
+  return vlen();
+}
+
+// setpriority(pid,nice): 设置进程pid(0表示当前进程)的nice值,超出-20~19时截断
+long
+sys_setpriority(struct pt_regs* pt)
+{
+  int nice = pt->a1;
+  struct task* t = task_get(pt->a0);
+  if (t == NULL)
+    return -1;
+  task_set_nice(t, max(-20, min(19, nice)));
+  spin_put(&t->lock);
+  return 0;
+}
+
+// sched_setscheduler(pid,policy,prio): 设置进程pid(0表示当前进程)的调度策略与实时优先级
+long
+sys_sched_setscheduler(struct pt_regs* pt)
+{
+  struct task* t = task_get(pt->a0);
+  if (t == NULL)
+    return -1;
+  bool ok = task_set_policy(t, pt->a1, pt->a2);
+  spin_put(&t->lock);
+  return ok ? 0 : -1;
+}
+
+// sched_setaffinity(pid,mask): 限制进程pid(0表示当前进程)只在mask中的cpu上运行,mask中没有已启动的cpu时返回-1
+long
+sys_sched_setaffinity(struct pt_regs* pt)
+{
+  struct task* t = task_get(pt->a0);
+  if (t == NULL)
+    return -1;
+  if (! task_set_affinity(t, pt->a1)) {
+    spin_put(&t->lock);
+    return -1;
+  }
+  bool migrate = (t == mytask() && (t->cpumask & CPU_BIT(cpuid())) == 0);
+  spin_put(&t->lock);
+  if (migrate) // 当前cpu已不被允许,让出后由task_ready放入允许的cpu
+    yield();
+  return 0;
+}
+
+// sched_getaffinity(pid,&mask)
+long
+sys_sched_getaffinity(struct pt_regs* pt)
+{
+  if (pt->a1 == 0)
+    return -1;
+  struct task* t = task_get(pt->a0);
+  if (t == NULL)
+    return -1;
+  u64 mask = t->cpumask;
+  spin_put(&t->lock);
+  copy_to_user((void*)pt->a1, &mask, sizeof(mask));
+  return 0;
+}
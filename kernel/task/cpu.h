@@ -1,12 +1,22 @@
 #pragma once
+#include "config.h"
 #include "types.h"
 #include "util/riscv.h"
+#include "util/spinlock.h"
 
 struct context {
   u64 ra, sp;
   u64 s0, s1, s2, s3, s4, s5, s6, s7, s8, s9, s10, s11;
 };
 
+// 已退出进程留下的任务资源: mm_struct、只映射了trapframe与trampoline的页表、内核栈与trapframe页
+struct mm_struct;
+struct task_res {
+  struct mm_struct* mm;
+  pagetable_t pagetable;
+  u64 kstack;
+};
+
 struct cpu {
   // 顺序必须固定的字段
   u64 id;
@@ -19,8 +29,29 @@ struct cpu {
   bool raw_intr;
   u8 spinlevel;
 
+  // 内核抢占: spinlevel与当前任务的preempt_off均为0且开中断时才可抢占
+  bool need_resched; // 时间片已到期但当时不可抢占,在下一个抢占点让出cpu
+  u64 ipi_seq;       // 已处理的核间中断数,TLB击落据此确认目标cpu已陷入过内核
+
   struct context ctx; // 调度器自身上下文
-};
+  struct task* prev;  // 刚让出本cpu的任务,切换完成后由切换到的一侧释放其锁
+
+  // 空闲统计(单位为time寄存器的计数),是否正在wfi等待记录在调度器的idle_mask中
+  u64 idle_time; // 累计空闲时间
+  u64 boot_time; // 开始调度的时间
+
+  // 惰性浮点与向量切换
+  struct task* fp_owner;  // 浮点寄存器中是哪个任务的状态
+  struct task* vec_owner; // 向量寄存器中是哪个任务的状态
+
+  // 任务资源缓存,只由本cpu在关中断时访问
+  struct task_res res_cache[NTASKRES];
+  u32 nres;
+
+  // MCS自旋锁的队列节点池,spin_used按位记录正在使用的节点
+  struct mcs_node spin_nodes[NSPINNODE];
+  u32 spin_used;
+} __attribute__((aligned(CACHE_LINE)));
 
 
 static inline __attribute__((always_inline)) struct cpu*
@@ -32,7 +63,10 @@ mycpu(void)
 static inline __attribute__((always_inline)) struct task*
 mytask(void)
 {
-  return mycpu()->cur_task;
+  //! 单条指令读取: 分两步读取时可能在中间被抢占并迁移,读到原cpu上其他任务
+  struct task* t;
+  asm volatile("ld %0, %1(tp)" : "=r"(t) : "i"(__builtin_offsetof(struct cpu, cur_task)));
+  return t;
 }
 
 static inline __attribute__((always_inline)) u64
@@ -41,6 +75,15 @@ cpuid(void)
   return mycpu()->id;
 }
 
+// 向cpu id发送核间中断
+static inline __attribute__((always_inline)) void
+send_ipi(u64 id)
+{
+  *(volatile u32*)(CLINT + 4 * id) = 1;
+}
+
+void preempt_point(void);
+
 static inline __attribute__((always_inline)) void
 push_intr(void)
 {
@@ -56,6 +99,9 @@ pop_intr(void)
 {
   struct cpu* c = mycpu();
   --c->spinlevel;
-  if (c->spinlevel == 0 && c->raw_intr == true)
+  if (c->spinlevel == 0 && c->raw_intr == true) {
     sti();
-}
\ No newline at end of file
+    if (c->need_resched) // 释放最后一个自旋锁即是抢占点
+      preempt_point();
+  }
+}
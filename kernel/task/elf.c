@@ -29,6 +29,10 @@ read_elfhdr(const char* path, struct elfhdr* eh)
   if (eh->machine != ELF_RISCV)
     goto not_exec;
 
+  // 每个段一个vma,另有用户栈
+  if (eh->phnum >= NVMA_MAX)
+    goto not_exec;
+
   return f;
 
 not_exec:
@@ -37,6 +41,7 @@ not_exec:
 }
 
 // 解析ELF程序段表,加载代码段和数据段,并进行页表映射
+// 含文件内容的页立即载入,只含bss的页留给缺页异常(读访问映射全局零页)
 void
 load_segment(struct task* t, struct file* f, struct elfhdr* eh)
 {
@@ -47,12 +52,6 @@ load_segment(struct task* t, struct file* f, struct elfhdr* eh)
   while (seg_cnt--) {
     fread(f, &pg, sizeof(pg), true);
     if (pg.type == ELF_PROG_LOAD && (pg.filesz > 0 || pg.memsz > 0)) {
-      struct page* p = alloc_page();
-      list_pushback(&t->mm_struct->page_head, &p->page_node);
-      int roff = fseek(f, pg.off, SEEK_SET);
-      fread(f, (void*)p->paddr, pg.filesz, true);
-      fseek(f, roff, SEEK_SET);
-
       u16 attr = PTE_U;
       if (pg.flags & ELF_PROG_FLAG_READ)
         attr |= PTE_R;
@@ -60,8 +59,22 @@ load_segment(struct task* t, struct file* f, struct elfhdr* eh)
         attr |= PTE_W;
       if (pg.flags & ELF_PROG_FLAG_EXEC)
         attr |= PTE_X;
-      task_vmmap(t, pg.vaddr, p->paddr, PGSIZE, attr, (attr & PTE_X) ? TEXT : DATA);
-      t->mm_struct->next_heap = pg.vaddr + PGSIZE;
+
+      u64 va = align_down(pg.vaddr, PGSIZE), bound = align_up(pg.vaddr + max(pg.memsz, pg.filesz), PGSIZE);
+      u64 fend = pg.vaddr + pg.filesz; // 文件内容结束地址
+      struct vma* v = vma_add(t, va, 0, bound - va, attr, (attr & PTE_X) ? TEXT : DATA);
+      int roff = f->off;
+      for (; va < fend; va += PGSIZE) {
+        struct page* p = alloc_page_for_task(t);
+        u64 s = max(va, pg.vaddr), e = min(va + PGSIZE, fend);
+        fseek(f, pg.off + (s - pg.vaddr), SEEK_SET);
+        fread(f, (void*)(p->paddr + (s - va)), e - s, true);
+        task_map_page(t, v, va, p->paddr, attr);
+        if (v->pa == 0)
+          v->pa = p->paddr;
+      }
+      fseek(f, roff, SEEK_SET);
+      t->mm_struct->next_heap = bound;
     }
   }
-}
\ No newline at end of file
+}
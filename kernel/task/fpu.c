@@ -0,0 +1,192 @@
+#include "config.h"
+#include "task/fpu.h"
+#include "task/task.h"
+#include "mem/alloc.h"
+#include "mem/vm.h"
+#include "util/riscv.h"
+#include "util/string.h"
+
+/*
+  惰性浮点与向量上下文切换
+  每个cpu的浮点/向量寄存器分别属于该cpu的fp_owner/vec_owner,任务的状态只在它确实使用时才载入:
+  返回用户态时若本cpu的寄存器不是该任务的最新状态则置FS/VS为Off,首次使用时触发非法指令异常后再载入
+  切换离开时只有FS/VS为Dirty(本次运行写过寄存器)才保存,从不使用浮点与向量的任务切换时只多读一次sstatus
+  向量上下文较大,在任务第一次使用向量指令时才分配
+  ! 内核不使用浮点与向量寄存器(按lp64无浮点编译),用户的状态在内核中保持不变
+*/
+
+extern void fp_save(struct fpstate* fp);
+extern void fp_load(struct fpstate* fp);
+extern void vec_save(struct vstate* vs, u64 vlenb);
+extern void vec_load(struct vstate* vs, u64 vlenb);
+
+static u64 vlenb; // 每个向量寄存器的字节数,0表示不支持V扩展
+
+static inline __attribute__((always_inline)) void
+set_status(u64 mask, u64 val)
+{
+  w_sstatus((r_sstatus() & ~mask) | val);
+}
+
+// 本cpu的浮点寄存器是否为t的最新状态,调用方需关中断
+static inline __attribute__((always_inline)) bool
+fp_live(struct task* t)
+{
+  return mycpu()->fp_owner == t && t->fp_cpu == cpuid();
+}
+
+static inline __attribute__((always_inline)) bool
+vec_live(struct task* t)
+{
+  return mycpu()->vec_owner == t && t->vec_cpu == cpuid();
+}
+
+// 探测V扩展: 未实现时sstatus.VS为只读0
+void
+init_fpu(void)
+{
+  set_status(SSTATUS_VS, SSTATUS_VS_CLEAN);
+  if (r_sstatus() & SSTATUS_VS)
+    asm volatile("csrr %0, 0xc22" : "=r"(vlenb)); // vlenb
+  set_status(SSTATUS_VS, SSTATUS_VS_OFF);
+  if (sizeof(struct vstate) + 32 * vlenb > PGSIZE) // 向量上下文只分配一页
+    vlenb = 0;
+}
+
+// 向量寄存器位宽(bit),0表示不支持
+u64
+vlen(void)
+{
+  return vlenb * 8;
+}
+
+void
+fp_init(struct task* t)
+{
+  memset(&t->fp, 0, sizeof(t->fp));
+  t->fp_cpu = NCPU;
+  t->vec = NULL;
+  t->vec_cpu = NCPU;
+}
+
+static struct vstate*
+vec_alloc(void)
+{
+  struct vstate* vs = (struct vstate*)alloc_page()->paddr;
+  memset(vs, 0, sizeof(struct vstate) + 32 * vlenb);
+  return vs;
+}
+
+// 子进程继承父进程的浮点与向量状态,父进程的寄存器中可能有尚未保存的修改
+void
+fp_fork(struct task* c, struct task* p)
+{
+  push_intr();
+  fp_switch_out(p);
+  pop_intr();
+  memcpy(&c->fp, &p->fp, sizeof(c->fp));
+  c->fp_cpu = NCPU;
+  c->vec = NULL;
+  c->vec_cpu = NCPU;
+  if (p->vec) {
+    c->vec = vec_alloc();
+    memcpy(c->vec, p->vec, sizeof(struct vstate) + 32 * vlenb);
+  }
+}
+
+// 丢弃t的浮点与向量状态并释放向量上下文(exit与exec),此后调度器不会再保存到其中
+void
+fp_release(struct task* t)
+{
+  push_intr();
+  struct vstate* vs = t->vec;
+  t->fp_cpu = t->vec_cpu = NCPU;
+  t->vec = NULL;
+  pop_intr();
+  if (vs)
+    free_page(page((u64)vs));
+}
+
+// 保存t在本cpu寄存器中尚未保存的修改,由调度器在t切换离开时关中断调用;寄存器仍保留,t回到本cpu时无需重新载入
+void
+fp_switch_out(struct task* t)
+{
+  u64 s = r_sstatus();
+  if ((s & SSTATUS_FS) == SSTATUS_FS_DIRTY && fp_live(t)) {
+    fp_save(&t->fp);
+    set_status(SSTATUS_FS, SSTATUS_FS_CLEAN);
+  }
+  if ((s & SSTATUS_VS) == SSTATUS_VS_DIRTY && vec_live(t)) {
+    vec_save(t->vec, vlenb);
+    set_status(SSTATUS_VS, SSTATUS_VS_CLEAN);
+  }
+}
+
+// t返回用户态时sstatus中FS与VS应取的值,调用方需关中断
+u64
+fp_user_status(struct task* t)
+{
+  u64 s = r_sstatus(), r = SSTATUS_FS_OFF | SSTATUS_VS_OFF;
+  if (fp_live(t))
+    r |= (s & SSTATUS_FS) == SSTATUS_FS_DIRTY ? SSTATUS_FS_DIRTY : SSTATUS_FS_CLEAN;
+  if (vec_live(t))
+    r |= (s & SSTATUS_VS) == SSTATUS_VS_DIRTY ? SSTATUS_VS_DIRTY : SSTATUS_VS_CLEAN;
+  return r;
+}
+
+// 向量指令: OP-V、宽度为向量宽度的LOAD-FP/STORE-FP,以及访问向量CSR的指令
+static bool
+is_vector(u32 insn)
+{
+  u32 opcode = insn & 0x7F, width = (insn >> 12) & 0x7, csr = insn >> 20;
+  if (opcode == 0x57)
+    return true;
+  if (opcode == 0x07 || opcode == 0x27)
+    return width == 0 || width >= 5;
+  if (opcode == 0x73 && width != 0)
+    return csr == 0x008 || csr == 0x009 || csr == 0x00A || csr == 0x00F || (csr >= 0xC20 && csr <= 0xC22);
+  return false;
+}
+
+/*
+  用户态非法指令异常,sstatus与sepc为陷入时的值
+  所需的单元处于Off时载入t的状态并返回true,由陷阱返回时启用该单元并重新执行指令;单元已启用时确实是非法指令
+*/
+bool
+fp_trap(struct task* t, u64 sstatus, u64 sepc)
+{
+  u32 insn = 0;
+  copy_from_user(&insn, (void*)sepc, 2);
+  if ((insn & 0x3) == 0x3) // 非压缩指令
+    copy_from_user((u16*)&insn + 1, (void*)sepc + 2, 2);
+
+  if (is_vector(insn)) {
+    if (vlenb == 0 || (sstatus & SSTATUS_VS) != SSTATUS_VS_OFF)
+      return false;
+    if (t->vec == NULL)
+      t->vec = vec_alloc();
+    push_intr();
+    if (! vec_live(t)) { // 原owner的状态已在切换离开时保存
+      set_status(SSTATUS_VS, SSTATUS_VS_CLEAN);
+      vec_load(t->vec, vlenb);
+      set_status(SSTATUS_VS, SSTATUS_VS_CLEAN); // 载入后硬件置为Dirty,此时寄存器与t->vec一致
+      mycpu()->vec_owner = t;
+      t->vec_cpu = cpuid();
+    }
+    pop_intr(); //! 可能在此被抢占并迁移,返回用户态时VS为Off,重新陷入后在新cpu上载入
+    return true;
+  }
+
+  if ((sstatus & SSTATUS_FS) != SSTATUS_FS_OFF)
+    return false;
+  push_intr();
+  if (! fp_live(t)) {
+    set_status(SSTATUS_FS, SSTATUS_FS_CLEAN);
+    fp_load(&t->fp);
+    set_status(SSTATUS_FS, SSTATUS_FS_CLEAN);
+    mycpu()->fp_owner = t;
+    t->fp_cpu = cpuid();
+  }
+  pop_intr();
+  return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "types.h"
+
+struct task;
+
+// 用户任务的浮点上下文,布局与switch.S中的fp_save/fp_load一致
+struct fpstate {
+  u64 f[32];
+  u64 fcsr;
+};
+
+// 用户任务的向量上下文,首次使用向量指令时按本机VLEN分配,布局与switch.S中的vec_save/vec_load一致
+struct vstate {
+  u64 vstart, vl, vtype, vcsr;
+  u8 v[]; // v0~v31,每个vlenb字节
+};
+
+void init_fpu(void);
+u64 vlen(void);
+
+void fp_init(struct task* t);
+void fp_fork(struct task* c, struct task* p);
+void fp_release(struct task* t);
+void fp_switch_out(struct task* t);
+u64 fp_user_status(struct task* t);
+bool fp_trap(struct task* t, u64 sstatus, u64 sepc);
@@ -0,0 +1,136 @@
+#include "config.h"
+#include "task/futex.h"
+#include "task/task.h"
+#include "task/sche.h"
+#include "task/timer.h"
+#include "mem/vm.h"
+#include "util/riscv.h"
+#include "util/spinlock.h"
+
+struct futex_bucket {
+  struct spinlock lock;
+  struct list_node head;
+};
+static struct futex_bucket futex_buckets[NFUTEX];
+
+// 等待者,位于等待任务的内核栈上
+struct futex_q {
+  struct list_node node;
+  u64 key;
+  struct futex_bucket* b;
+  bool woken;    // 被futex_wake唤醒
+  bool timedout; // 超时
+};
+
+void
+init_futex(void)
+{
+  for (int i = 0; i < NFUTEX; ++i) {
+    futex_buckets[i].lock.lname = "futex-lock";
+    list_init(&futex_buckets[i].head);
+  }
+}
+
+static inline __attribute__((always_inline)) struct futex_bucket*
+bucket_of(u64 key)
+{
+  return &futex_buckets[((key >> 2) ^ (key >> 12)) % NFUTEX];
+}
+
+/*
+  将用户地址转换为物理地址作为键,失败返回0
+  按读访问载入页面,共享文件映射的页不会因此被标记为脏页而回写
+  只有匿名页的读缺页映射的是全局零页,首次写入后物理地址才确定,此时再按写访问换成私有页
+*/
+static u64
+futex_key(u64 uaddr)
+{
+  if (uaddr == 0 || uaddr % sizeof(u32) || uaddr >= USTACK + PGSIZE)
+    return 0;
+  u64 pa = va_to_pa(mytask()->pagetable, uaddr, NULL);
+  if (pa == 0) {
+    if (! do_page_fault(uaddr, false))
+      return 0;
+    pa = va_to_pa(mytask()->pagetable, uaddr, NULL);
+  }
+  if (pa && is_zero_page(pa)) {
+    if (! do_page_fault(uaddr, true))
+      return 0;
+    pa = va_to_pa(mytask()->pagetable, uaddr, NULL);
+  }
+  return pa;
+}
+
+static void
+futex_timeout(struct timer* tm)
+{
+  struct futex_q* q = tm->arg;
+  spin_get(&q->b->lock);
+  q->timedout = true;
+  wakeup(q);
+  spin_put(&q->b->lock);
+}
+
+/*
+  若*uaddr仍等于val则睡眠,直到被futex_wake唤醒或经过timeout个time计数(0表示不超时)
+  被唤醒返回0,值不相等、超时或地址非法返回-1
+  ! 比较与入队在同一个桶锁内完成,唤醒方修改值后再futex_wake,因此不会丢失唤醒
+*/
+int
+futex_wait(u64 uaddr, u32 val, u64 timeout)
+{
+  u64 key = futex_key(uaddr);
+  if (key == 0)
+    return -1;
+
+  struct futex_bucket* b = bucket_of(key);
+  struct futex_q q = { .key = key, .b = b, .woken = false, .timedout = false };
+  struct timer tm = { .fn = futex_timeout, .arg = &q };
+  if (timeout) //! 定时器回调会获取桶锁,因此定时器只能在桶锁之外添加与删除
+    timer_add(&tm, r_time() + timeout);
+
+  spin_get(&b->lock);
+  if (*(volatile u32*)key != val) {
+    spin_put(&b->lock);
+    if (timeout)
+      timer_del(&tm);
+    return -1;
+  }
+  list_pushback(&b->head, &q.node);
+  while (! q.woken && ! q.timedout)
+    if (! sleep_killable(&q, &b->lock))
+      break;
+  if (! q.woken)
+    list_remove(&q.node);
+  spin_put(&b->lock);
+
+  if (timeout)
+    timer_del(&tm);
+  return q.woken ? 0 : -1;
+}
+
+// 唤醒最多n个等待uaddr的任务,返回唤醒的个数
+int
+futex_wake(u64 uaddr, int n)
+{
+  u64 key = futex_key(uaddr);
+  if (key == 0)
+    return -1;
+
+  struct futex_bucket* b = bucket_of(key);
+  int cnt = 0;
+  spin_get(&b->lock);
+  struct list_node* node = b->head.next;
+  while (node != &b->head && cnt < n) {
+    struct futex_q* q = container_of(node, struct futex_q, node);
+    node = node->next;
+    if (q->key != key) // 哈希冲突
+      continue;
+    list_remove(&q->node);
+    q->woken = true;
+    wakeup(q);
+    ++cnt;
+  }
+  spin_put(&b->lock);
+  return cnt;
+}
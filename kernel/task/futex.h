@@ -0,0 +1,10 @@
+#pragma once
+#include "types.h"
+
+/*
+  futex: 用户态在内存字上阻塞与唤醒
+  以字所在的物理地址为键,共享映射的不同虚拟地址对应同一个futex
+*/
+void init_futex(void);
+int futex_wait(u64 uaddr, u32 val, u64 timeout);
+int futex_wake(u64 uaddr, int n);
@@ -1,6 +1,7 @@
 #include "task/task.h"
 #include "mem/vm.h"
 #include "util/string.h"
+#include "task/sche.h"
 void
 init_proc1(void)
 {
@@ -11,5 +12,7 @@ init_proc1(void)
   t->lock.lname = "systemd-lock";
   t->ctx.ra = (u64)first_sched;
   t->ctx.sp = t->kstack;
-  t->state = READY;
+  spin_get(&t->lock);
+  task_ready(t);
+  spin_put(&t->lock);
 }
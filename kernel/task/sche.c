@@ -4,19 +4,480 @@
 #include "util/printf.h"
 #include "task/elf.h"
 #include "fs/file.h"
+#include "task/sche.h"
+#include "task/timer.h"
 
 extern struct task task_queue[NPROC];
 
+/*
+  每个cpu一个运行队列,READY的普通任务按vruntime升序挂在head上,实时任务按优先级降序挂在rt_head上
+  调度时先取rt_head队首的实时任务,再从本cpu队首取vruntime最小的任务,本队列为空时从任务最多的队列窃取
+  ! 加锁顺序: t->lock -> rq->lock,调度器取任务时只持有rq->lock
+*/
+struct rq {
+  struct spinlock lock;
+  struct list_node head;
+  struct list_node rt_head;
+  u32 nr;           // 队列中的任务数(含实时任务),窃取时无锁读取仅作参考
+  u64 min_vruntime; // 单调递增,新就绪的任务vruntime不小于它
+
+  // 实时任务限流,只由本cpu访问
+  u64 rt_period_start; // 当前限流周期的开始时间
+  u64 rt_time;         // 本周期内实时任务已运行的时间
+} __attribute__((aligned(CACHE_LINE)));
+static struct rq rqs[NCPU];
+
+/*
+  online_mask: 已开始调度的cpu,放置与窃取任务时只考虑这些cpu
+  idle_mask: 正在wfi等待的cpu,向其运行队列放入任务时需发送核间中断
+*/
+static volatile u64 online_mask, idle_mask;
+
+/*
+  公平调度: 任务实际运行时间按权重折算为vruntime,总是运行vruntime最小的任务
+  nice值-20~19对应的权重,nice每差1,cpu时间约相差1.25倍
+*/
+#define NICE_0_WEIGHT 1024
+static const u32 nice_to_weight[40] = {
+  /* -20 */ 88761, 71755, 56483, 46273, 36291,
+  /* -15 */ 29154, 23254, 18705, 14949, 11916,
+  /* -10 */ 9548,  7620,  6100,  4904,  3906,
+  /*  -5 */ 3121,  2501,  1991,  1586,  1277,
+  /*   0 */ 1024,  820,   655,   526,   423,
+  /*   5 */ 335,   272,   215,   172,   137,
+  /*  10 */ 110,   87,    70,    56,    45,
+  /*  15 */ 36,    29,    23,    18,    15,
+};
+
+void
+task_set_nice(struct task* t, int nice)
+{
+  t->nice = nice;
+  t->weight = nice_to_weight[nice + 20];
+}
+
+#define is_rt(t) ((t)->policy != SCHED_NORMAL)
+
+// 设置t的调度策略,已在运行队列中的任务在下次就绪时才按新的策略排队,调用方持有t->lock
+bool
+task_set_policy(struct task* t, int policy, int prio)
+{
+  if (policy == SCHED_NORMAL ? prio != 0 : (policy != SCHED_FIFO && policy != SCHED_RR) || prio < 1 || prio > RT_PRIO_MAX)
+    return false;
+  t->policy = policy;
+  t->rt_prio = prio;
+  return true;
+}
+
+// 设置t允许运行的cpu,mask中没有已启动的cpu时失败(否则任务会进入无人服务的运行队列),调用方持有t->lock
+bool
+task_set_affinity(struct task* t, u64 mask)
+{
+  if ((mask & CPUMASK_ALL & online_mask) == 0)
+    return false;
+  t->cpumask = mask & CPUMASK_ALL;
+  return true;
+}
+
+// 本cpu的实时任务是否已用完本周期的运行时间,新周期开始时重新计时
+static bool
+rt_throttled(struct rq* rq, u64 now)
+{
+  if (now - rq->rt_period_start >= RT_PERIOD) {
+    rq->rt_period_start = now;
+    rq->rt_time = 0;
+  }
+  return rq->rt_time >= RT_RUNTIME;
+}
+
+// 将t自上次开始运行以来的时间按权重计入vruntime,实时任务的运行时间计入所在cpu的限流统计
+static void
+update_vruntime(struct task* t)
+{
+  u64 now = r_time();
+  t->vruntime += (now - t->exec_start) * NICE_0_WEIGHT / t->weight;
+  t->sum_exec += now - t->exec_start;
+  if (is_rt(t))
+    rqs[t->cpu].rt_time += now - t->exec_start;
+  t->exec_start = now;
+}
+
+#define ticks_to_us(x) ((x) * 1000000 / TIMEBASE_FREQ)
+
+static u32 latency_hist[NLATENCY]; // 唤醒到运行的延迟直方图,各cpu原子累加
+
+// 任务开始运行: 累计就绪等待时间,由唤醒引起的就绪计入延迟直方图
+static void
+account_ready(struct task* t, u64 now)
+{
+  u64 delay = now - t->ready_start;
+  t->sum_wait += delay;
+  if (! t->woken)
+    return;
+  u64 us = ticks_to_us(delay);
+  int i = 0;
+  while (i < NLATENCY - 1 && (us >> (i + 1)))
+    ++i;
+  __sync_fetch_and_add(&latency_hist[i], 1);
+}
+
+static void
+rq_insert(struct rq* rq, struct task* t)
+{
+  struct list_node* node;
+  if (is_rt(t)) { // 同优先级的实时任务先到先运行
+    node = rq->rt_head.next;
+    while (node != &rq->rt_head && container_of(node, struct task, rq_node)->rt_prio >= t->rt_prio)
+      node = node->next;
+  } else {
+    node = rq->head.next;
+    while (node != &rq->head && container_of(node, struct task, rq_node)->vruntime <= t->vruntime)
+      node = node->next;
+  }
+  list_pushback(node, &t->rq_node); // 插入到node之前
+  ++rq->nr;
+}
+
+/*
+  等待队列按chan哈希分桶,sleep的任务挂在chan所在的桶中,唤醒时只需遍历该桶
+  ! 加锁顺序: wq->lock -> t->lock -> rq->lock
+*/
+struct waitq {
+  struct spinlock lock;
+  struct list_node head;
+};
+static struct waitq waitqs[NWAITQ];
+
+static inline __attribute__((always_inline)) struct waitq*
+waitq_of(void* chan)
+{
+  u64 key = (u64)chan;
+  return &waitqs[((key >> 3) ^ (key >> 12)) % NWAITQ];
+}
+
+void
+init_rq(void)
+{
+  for (int i = 0; i < NCPU; ++i) {
+    rqs[i].lock.lname = "rq-lock";
+    list_init(&rqs[i].head);
+    list_init(&rqs[i].rt_head);
+    rqs[i].nr = 0;
+    rqs[i].min_vruntime = 0;
+    rqs[i].rt_period_start = rqs[i].rt_time = 0;
+  }
+  for (int i = 0; i < NWAITQ; ++i) {
+    waitqs[i].lock.lname = "waitq-lock";
+    list_init(&waitqs[i].head);
+  }
+}
+
+extern struct cpu cpus[NCPU];
+
+// 唤醒空闲的cpu id;若它不空闲则唤醒任意一个允许运行t的空闲cpu来窃取任务
+static void
+kick_idle(struct task* t, u64 id)
+{
+  u64 idle = idle_mask;
+  if (! (idle & CPU_BIT(id))) {
+    idle &= t->cpumask;
+    id = idle ? __builtin_ctzl(idle) : NCPU;
+  }
+  if (id < NCPU && id != cpuid())
+    send_ipi(id);
+}
+
+/*
+  实时任务t放入cpu id的运行队列后,若该cpu正在运行普通任务或优先级更低的实时任务,要求其尽快重新调度
+  目标为本cpu时置起软件中断,在当前关中断的代码结束后立即处理
+*/
+static void
+kick_rt(struct task* t, u64 id)
+{
+  struct task* cur = cpus[id].cur_task; // 无锁读取,最坏情况下推迟到时间片到期
+  if (cur == NULL || cur == t || (is_rt(cur) && cur->rt_prio >= t->rt_prio))
+    return;
+  cpus[id].need_resched = true;
+  if (id == cpuid())
+    w_sip(r_sip() | SIP_SSIP);
+  else
+    send_ipi(id);
+}
+
+/*
+  软亲和: 优先留在最近运行的cpu上,不被允许时选择允许的在线cpu中任务最少的一个
+  只选择已启动的cpu: 当前cpu正在执行,即使还未进入task_schedule(启动时创建的kworker)也视为在线
+  允许的cpu都未启动时忽略亲和性,不能把任务放入没有cpu服务的运行队列
+*/
+static u16
+select_cpu(struct task* t)
+{
+  u64 online = online_mask | CPU_BIT(cpuid());
+  u64 allowed = t->cpumask & online;
+  if (allowed == 0)
+    allowed = online;
+  if (allowed & CPU_BIT(t->cpu))
+    return t->cpu;
+  int best = -1;
+  for_each_cpu(i, allowed)
+    if (best < 0 || rqs[i].nr < rqs[best].nr)
+      best = i;
+  return best;
+}
+
+// 将t置为READY并放入其最近运行cpu(或允许的cpu)的运行队列,调用方必须持有t->lock
+void
+task_ready(struct task* t)
+{
+  t->cpu = select_cpu(t);
+  struct rq* rq = &rqs[t->cpu];
+  if (t->state == RUN) // 当前任务主动让出
+    update_vruntime(t);
+  if (t->state != READY) { // 因亲和性被重新放入队列的任务保留原来的就绪时间
+    t->ready_start = r_time();
+    t->woken = t->state == SLEEP;
+  }
+  t->state = READY;
+  spin_get(&rq->lock);
+  if (t->vruntime < rq->min_vruntime) // 睡眠或新建的任务不能凭借过小的vruntime长期独占cpu
+    t->vruntime = rq->min_vruntime;
+  rq_insert(rq, t);
+  spin_put(&rq->lock);
+  __sync_synchronize(); //! 与调度器中先置idle再检查队列配对,保证不会错过唤醒
+  kick_idle(t, t->cpu);
+  if (is_rt(t))
+    kick_rt(t, t->cpu);
+}
+
+// 取出本cpu队列中下一个要运行的任务: 实时任务优先,限流时只要有普通任务就先运行普通任务
+static struct task*
+rq_pop(struct rq* rq)
+{
+  struct task* t = NULL;
+  spin_get(&rq->lock);
+  if (rq->nr) {
+    struct list_node* node = rq->head.next;
+    if (rq->rt_head.next != &rq->rt_head && (node == &rq->head || ! rt_throttled(rq, r_time())))
+      node = rq->rt_head.next;
+    list_remove(node);
+    --rq->nr;
+    t = container_of(node, struct task, rq_node);
+    if (! is_rt(t))
+      rq->min_vruntime = max(rq->min_vruntime, t->vruntime);
+  }
+  spin_put(&rq->lock);
+  return t;
+}
+
+// 找到第一个允许在cpu self上运行的任务(实时任务从高优先级起,普通任务从队尾起),steal为真时将其摘下
+static struct task*
+rq_find_allowed(struct rq* rq, u64 self, bool steal)
+{
+  struct task* t = NULL;
+  spin_get(&rq->lock);
+  for (struct list_node* node = rq->rt_head.next; node != &rq->rt_head; node = node->next) {
+    struct task* s = container_of(node, struct task, rq_node);
+    if (s->cpumask & CPU_BIT(self)) {
+      t = s;
+      break;
+    }
+  }
+  for (struct list_node* node = rq->head.prev; t == NULL && node != &rq->head; node = node->prev) {
+    struct task* s = container_of(node, struct task, rq_node);
+    if (s->cpumask & CPU_BIT(self)) {
+      t = s;
+      break;
+    }
+  }
+  if (t && steal) {
+    list_remove(&t->rq_node);
+    --rq->nr;
+  }
+  spin_put(&rq->lock);
+  return t;
+}
+
+// 从任务最多的运行队列窃取一个允许在本cpu运行的任务,普通任务从队尾窃取,队首留给该队列所属的cpu
+static struct task*
+rq_steal(u64 self)
+{
+  struct rq* busiest = NULL;
+  u64 others = online_mask & ~CPU_BIT(self);
+  for_each_cpu(i, others)
+    if (rqs[i].nr && (busiest == NULL || rqs[i].nr > busiest->nr))
+      busiest = &rqs[i];
+  struct task* t = busiest ? rq_find_allowed(busiest, self, true) : NULL;
+  for_each_cpu(i, others) // 最忙的队列中没有可窃取的任务
+    if (t == NULL && rqs[i].nr && &rqs[i] != busiest)
+      t = rq_find_allowed(&rqs[i], self, true);
+  return t;
+}
+
+// 是否有本cpu可以运行的任务
+static bool
+rq_has_work(u64 self)
+{
+  if (rqs[self].nr)
+    return true;
+  for_each_cpu(i, online_mask & ~CPU_BIT(self))
+    if (rqs[i].nr && rq_find_allowed(&rqs[i], self, false))
+      return true;
+  return false;
+}
+
+/*
+  没有可运行的任务时执行wfi,直到时钟中断或其他cpu放入任务后发送的核间中断到来
+  ! 先置idle再检查队列: 放入任务的cpu要么看到idle而发送核间中断,要么任务已对本cpu可见
+*/
+static void
+idle(struct cpu* c)
+{
+  __sync_fetch_and_or(&idle_mask, CPU_BIT(c->id)); // 带有完整的内存屏障
+  if (! rq_has_work(c->id)) {
+    timer_tick(false); // 空闲时只在定时器到期时产生时钟中断
+    u64 start = r_time();
+    wfi(); // 关中断状态下wfi仍会因挂起的中断返回,中断在随后的sti中处理
+    c->idle_time += r_time() - start;
+  }
+  __sync_fetch_and_and(&idle_mask, ~CPU_BIT(c->id));
+}
+
 extern char trampoline[];
 extern char utrap_entry[];
 extern char run_new_task[];
 
 extern void context_switch(struct context* old, struct context* new);
 extern void fsinit(void);
+
+// 取出下一个可在本cpu运行的任务并加锁,steal为假时只看本cpu的运行队列,没有时返回NULL
+static struct task*
+pick_next(struct cpu* c, bool steal)
+{
+  while (1) {
+    struct task* t = rq_pop(&rqs[c->id]);
+    if (t == NULL && (! steal || (t = rq_steal(c->id)) == NULL))
+      return NULL;
+    spin_get(&t->lock); //! 刚放入队列的任务可能仍被原cpu持有锁,等待其切换完成
+    if (t->state == READY && (t->cpumask & CPU_BIT(c->id)) == 0) { // 在队列中时亲和性被修改
+      task_ready(t);
+      spin_put(&t->lock);
+      continue;
+    }
+    if (t->state == READY)
+      return t;
+    spin_put(&t->lock);
+  }
+}
+
+// 开始运行的实时任务在本cpu本周期剩余的运行时间用完时触发时钟中断,由限流决定是否让给普通任务
+static void
+rt_slice(struct cpu* c, struct task* t)
+{
+  struct rq* rq = &rqs[c->id];
+  if (is_rt(t) && ! rt_throttled(rq, t->exec_start))
+    timer_slice(t->exec_start + RT_RUNTIME - rq->rt_time);
+}
+
+// 准备在本cpu上运行已加锁的next
+static void
+switch_in(struct cpu* c, struct task* next)
+{
+  if (next->cpu != c->id) { // 窃取的任务: vruntime换算为相对本队列min_vruntime的值
+    u64 src = rqs[next->cpu].min_vruntime;
+    next->vruntime = rqs[c->id].min_vruntime + (next->vruntime > src ? next->vruntime - src : 0);
+  }
+  next->state = RUN;
+  next->cpu = c->id;
+  next->exec_start = r_time();
+  account_ready(next, next->exec_start);
+  timer_tick(true);
+  rt_slice(c, next);
+  c->need_resched = false;
+  c->cur_task = next;
+  c->cur_kstack = next->kstack;
+  c->cur_satp = SATP_MODE | ((u64)next->pagetable >> 12);
+}
+
+/*
+  切换的收尾,在切换到的一侧(任务或调度器)执行: 让出的任务此时已不在cpu上运行
+  仍要运行的任务这时才放入运行队列并释放其锁,因此运行队列中的任务不会被某个cpu持有锁等待其他任务锁
+*/
+void
+finish_switch(void)
+{
+  struct cpu* c = mycpu();
+  struct task* prev = c->prev;
+  if (prev == NULL)
+    return;
+  c->prev = NULL;
+  if (prev->state == READY)
+    task_ready(prev);
+  c->raw_intr = false; //! 中断状态由切换到的一侧自己恢复
+  spin_put(&prev->lock);
+}
+
+/*
+  READY的prev是否比next更应该继续运行: 实时任务先于普通任务(限流时除外),实时任务之间比较优先级,
+  同优先级时FIFO任务继续运行而RR任务轮转;普通任务之间比较vruntime
+*/
+static bool
+keep_running(struct cpu* c, struct task* prev, struct task* next)
+{
+  if (next == NULL)
+    return true;
+  if (is_rt(prev) && is_rt(next))
+    return prev->rt_prio > next->rt_prio || (prev->rt_prio == next->rt_prio && prev->policy == SCHED_FIFO);
+  if (is_rt(prev))
+    return ! rt_throttled(&rqs[c->id], r_time());
+  if (is_rt(next)) // rq_pop只在未限流或没有普通任务时取出实时任务
+    return false;
+  return prev->vruntime <= next->vruntime;
+}
+
+/*
+  当前任务prev让出cpu,调用方持有prev->lock并已设置其状态(READY/SLEEP/EXIT)
+  直接切换到本cpu运行队列中的下一个任务,本队列为空时才回到调度器(窃取或空闲)
+  READY的prev在keep_running时继续运行;save为假时不保存prev的上下文(exec已将其设为first_sched)
+*/
+void
+schedule(struct task* prev, bool save)
+{
+  struct cpu* c = mycpu();
+  update_vruntime(prev);
+  struct task* next = prev->state == EXIT ? NULL : pick_next(c, false); //! 退出的任务内核栈可能已释放,尽快离开
+  if (save && prev->state == READY && (prev->cpumask & CPU_BIT(c->id)) && keep_running(c, prev, next)) {
+    if (next) {
+      task_ready(next);
+      spin_put(&next->lock);
+    }
+    prev->state = RUN;
+    rt_slice(c, prev);
+    return;
+  }
+
+  if (prev->state == READY) {
+    prev->ready_start = r_time();
+    prev->woken = false;
+    ++prev->nivcsw;
+  } else if (prev->state == SLEEP)
+    ++prev->nvcsw;
+  fp_switch_out(prev);
+  c->prev = prev;
+  if (next) {
+    switch_in(c, next);
+    context_switch(save ? &prev->ctx : NULL, &next->ctx);
+  } else {
+    c->cur_task = NULL;
+    context_switch(save ? &prev->ctx : NULL, &c->ctx);
+  }
+  finish_switch();
+}
+
 void
 first_sched(void)
 {
   struct task* t = mytask();
+  finish_switch();
   spin_put(&t->lock);
   u64 _start = (u64)run_new_task - (u64)trampoline + TRAMPOLINE; // run_new_task的高虚拟地址
 
@@ -40,91 +501,221 @@ first_sched(void)
   */
 
   w_stvec((u64)utrap_entry - (u64)trampoline + TRAMPOLINE);
-  w_sstatus((r_sstatus() & ~SSTATUS_SPP) | SSTATUS_SPIE);
+  w_sstatus((r_sstatus() & ~(SSTATUS_SPP | SSTATUS_FS | SSTATUS_VS)) | SSTATUS_SPIE | fp_user_status(t));
   w_sepc(t->entry);
-  ((void (*)(u64, u64, u64))_start)(mycpu()->cur_satp, t->ustack, t->ustack == USTACK + PGSIZE ? 0 : t->ustack);
-  // t->ustack == USTACK + PGSIZE表示没有选项参数
+  ((void (*)(u64, u64, u64))_start)(mycpu()->cur_satp, t->ustack, t->uarg);
+}
+
+// 内核线程的入口: 在内核态开中断运行entry(uarg),可以睡眠与被抢占
+void
+kthread_entry(void)
+{
+  struct task* t = mytask();
+  finish_switch();
+  spin_put(&t->lock);
+  sti();
+  ((void (*)(void*))t->entry)((void*)t->uarg);
+  panic("kthread_entry: %s returned", t->tname);
+}
+
+/*
+  抢占点: 时间片已到期,且当前任务未持有自旋锁、未禁止抢占、处于开中断状态时让出cpu
+  关中断时(中断处理、调度器及其切换路径)直接返回
+*/
+void
+preempt_point(void)
+{
+  if (! intr())
+    return;
+  cli();
+  struct cpu* c = mycpu();
+  struct task* t = c->cur_task;
+  bool resched = c->need_resched && c->spinlevel == 0 && t && t->preempt_off == 0 && t->state == RUN;
+  if (resched)
+    c->need_resched = false;
+  sti();
+  if (resched)
+    yield();
+}
+
+// 禁止当前任务被抢占,可以嵌套
+void
+preempt_disable(void)
+{
+  push_intr();
+  ++mytask()->preempt_off;
+  pop_intr();
+}
+
+void
+preempt_enable(void)
+{
+  push_intr();
+  --mytask()->preempt_off;
+  pop_intr(); // 若期间时间片到期,在此处让出cpu
 }
 
 void
 yield(void)
 {
   struct task* t = mytask();
+  bool on = intr(); // 被抢占的内核代码原本开中断
   spin_get(&t->lock); //``
   t->state = READY;
-  context_switch(&t->ctx, &mycpu()->ctx);
+  schedule(t, true);
   spin_put(&t->lock); //*
+  if (on)
+    sti(); //! 切换回来时的中断状态来自调度器或其他任务,需恢复
 }
 
-void
-sleep(void* chan, struct spinlock* lock) // 调用sleep时最多只能持有1个自旋锁
+// killable时已被kill_thread标记的任务不再睡眠,返回任务是否未被标记
+static bool
+do_sleep(void* chan, struct spinlock* lock, bool killable)
 {
   struct task* t = mytask();
+  struct waitq* wq = waitq_of(chan);
+  bool on = lock ? mycpu()->raw_intr : intr(); // 睡眠前的中断状态,醒来后恢复以保持可抢占
 
-  spin_get(&t->lock);
+  spin_get(&wq->lock);
   if (lock)
-    spin_put(lock); //! lock必须在获得t->lock后再释放,防止唤醒丢失
+    spin_put(lock); //! lock必须在获得wq->lock后再释放,防止唤醒丢失
 
-  t->chan = chan;
-  t->state = SLEEP;
-  context_switch(&t->ctx, &mycpu()->ctx);
-  t->chan = NULL;
+  spin_get(&t->lock); //! 与kill_thread在任务锁内互斥: 要么这里看到killed,要么它看到SLEEP并唤醒chan
+  if (killable && t->killed)
+    spin_put(&wq->lock);
+  else {
+    t->chan = chan;
+    t->state = SLEEP;
+    list_pushback(&wq->head, &t->wait_node);
+    spin_put(&wq->lock);
+    schedule(t, true);
+    t->chan = NULL;
+  }
+  bool alive = ! (killable && t->killed);
   spin_put(&t->lock);
-  if (lock)
+  if (lock) {
     spin_get(lock); //! 重新申请因等待而被暂时释放的自旋锁
+    mycpu()->raw_intr = on;
+  } else if (on)
+    sti();
+  return alive;
+}
+
+void
+sleep(void* chan, struct spinlock* lock) // 调用sleep时最多只能持有1个自旋锁
+{
+  do_sleep(chan, lock, false);
+}
+
+/*
+  可中断的睡眠: 等待不确定何时发生的事件(futex、pipe、终端输入、wait等)时使用
+  返回false表示所属进程已退出,调用方应放弃等待尽快返回用户态,线程在返回前结束
+*/
+bool
+sleep_killable(void* chan, struct spinlock* lock)
+{
+  return do_sleep(chan, lock, true);
 }
 
 
+static void
+do_wakeup(void* chan, bool one)
+{
+  struct waitq* wq = waitq_of(chan);
+  spin_get(&wq->lock);
+  struct list_node* node = wq->head.next;
+  while (node != &wq->head) {
+    struct task* t = container_of(node, struct task, wait_node);
+    node = node->next;
+    if (t->chan != chan) // 哈希冲突
+      continue;
+    spin_get(&t->lock);
+    list_remove(&t->wait_node);
+    task_ready(t);
+    spin_put(&t->lock);
+    if (one)
+      break;
+  }
+  spin_put(&wq->lock);
+}
+
+// 唤醒所有等待chan的任务
 void
 wakeup(void* chan)
 {
-  for (int i = 0; i < NPROC; ++i) {
-    struct task* t = task_queue + i;
-    if (t != mytask()) {
-      spin_get(&t->lock);
-      if (t->state == SLEEP && t->chan == chan)
-        t->state = READY;
-      spin_put(&t->lock);
-    }
-  }
+  do_wakeup(chan, false);
 }
 
+// 只唤醒最早等待chan的一个任务
 void
-kill(void)
+wakeup_one(void* chan)
 {
-  extern void context_switch(struct context * old, struct context * new);
+  do_wakeup(chan, true);
+}
 
+void
+kill(void)
+{
   struct task* t = mytask();
   t->exit_code = 255;
+  if (! is_thread(t))
+    exit_threads(t);
+  orphan_childs(t); // 被结束的线程也可能fork过子进程
 
+  preempt_disable(); //! clean_source会释放仍在使用的内核栈页
   clean_source(t);
 
+  spin_get(&wait_lock);
+  wakeup(is_thread(t) ? (void*)t : &t->parent->childs); // 线程由join等待
+  spin_get(&t->lock); //! 父进程在wait中获取t->lock后才回收,保证此时已切换离开
   t->state = EXIT;
-  wakeup(&t->parent->childs);
-
-  spin_get(&t->lock);
-  context_switch(&t->ctx, &mycpu()->ctx);
+  spin_put(&wait_lock);
+  preempt_enable(); // 持有t->lock,不会被抢占
+  schedule(t, false);
 }
 
 void
 task_schedule(void)
 {
+  struct cpu* c = mycpu();
+  c->boot_time = r_time();
+  __sync_fetch_and_or(&online_mask, CPU_BIT(c->id));
   while (1) {
     sti();
     cli();
-    for (int i = 0; i < NPROC; ++i) {
-      struct task* t = task_queue + i;
-      struct cpu* c = mycpu();
-      spin_get(&t->lock);
-      if (t->state == READY) {
-        t->state = RUN;
-        c->cur_task = t;
-        c->cur_kstack = t->kstack;
-        c->cur_satp = SATP_MODE | ((u64)t->pagetable >> 12);
-        context_switch(&c->ctx, &t->ctx);
-      }
-      c->cur_task = NULL; //! 不要在释放线程锁后置空,可能会被中断
-      spin_put(&t->lock);
+    struct task* t = pick_next(c, true);
+    if (t == NULL) {
+      idle(c);
+      continue;
     }
+    switch_in(c, t);
+    context_switch(&c->ctx, &t->ctx);
+    finish_switch(); // 任务没有下一个可直接切换的任务时回到这里
   }
-}
\ No newline at end of file
+}
+
+// 获取进程pid(0表示当前进程)的调度统计与全局唤醒延迟直方图
+bool
+task_schedstat(u16 pid, struct schedstat* st)
+{
+  struct task* t = task_get(pid);
+  if (t == NULL)
+    return false;
+  st->exec_time = ticks_to_us(t->sum_exec);
+  st->wait_time = ticks_to_us(t->sum_wait);
+  st->nvcsw = t->nvcsw;
+  st->nivcsw = t->nivcsw;
+  spin_put(&t->lock);
+  for (int i = 0; i < NLATENCY; ++i)
+    st->latency[i] = latency_hist[i];
+  return true;
+}
+
+void
+dump_latency(void)
+{
+  print("\nwakeup latency(us)\n");
+  for (int i = 0; i < NLATENCY; ++i)
+    if (latency_hist[i])
+      print("  %d~%d: %d\n", i ? 1 << i : 0, 1 << (i + 1), latency_hist[i]);
+}
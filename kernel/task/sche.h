@@ -1,11 +1,49 @@
 #pragma once
 
+// 唤醒延迟直方图桶数: 第0个桶统计不足2微秒,第i个桶统计[2^i,2^(i+1))微秒,最后一个桶包含更长的延迟
+#define NLATENCY 16
+
+// 调度统计,时间单位为微秒
+struct schedstat {
+  unsigned long exec_time;        // 累计运行时间
+  unsigned long wait_time;        // 累计处于READY但未运行的时间
+  unsigned int nvcsw;             // 主动切换(睡眠)次数
+  unsigned int nivcsw;            // 被动切换(抢占、让出)次数
+  unsigned int latency[NLATENCY]; // 全局: 从被唤醒到开始运行的延迟直方图
+};
+
+// 调度策略,实时任务总是先于普通任务运行
+#define SCHED_NORMAL 0  // 公平调度
+#define SCHED_FIFO   1  // 实时: 同优先级先到先运行,直到睡眠或被更高优先级的任务抢占
+#define SCHED_RR     2  // 实时: 同优先级的任务按时间片轮转
+#define RT_PRIO_MAX  99 // 实时优先级1~99,越大越优先
+
+#ifndef USER
 struct spinlock;
+struct task;
 
+void init_rq(void);
+void task_ready(struct task* t);
+void task_set_nice(struct task* t, int nice);
+bool task_set_policy(struct task* t, int policy, int prio);
+bool task_set_affinity(struct task* t, unsigned long mask);
+
+void preempt_disable(void);
+void preempt_enable(void);
+void preempt_point(void);
+
+void schedule(struct task* prev, bool save);
+void finish_switch(void);
 void yield(void);
 
 void sleep(void* chan, struct spinlock* lock);
+bool sleep_killable(void* chan, struct spinlock* lock);
 
 void wakeup(void* chan);
+void wakeup_one(void* chan);
+
+void kill(void);
 
-void kill(void);
\ No newline at end of file
+bool task_schedstat(unsigned short pid, struct schedstat* st);
+void dump_latency(void);
+#endif
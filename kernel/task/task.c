@@ -1,24 +1,33 @@
 #include "task/task.h"
+#include "task/sche.h"
 #include "mem/alloc.h"
 #include "mem/vm.h"
 #include "mem/slot.h"
 #include "util/string.h"
 #include "util/spinlock.h"
+#include "util/rwlock.h"
 #include "util/printf.h"
 #include "fs/inode.h"
 #include "fs/pipe.h"
+#include "task/elf.h"
 
 
-INIT_SPINLOCK(tq);
+/*
+  任务槽的分配(FREE->INIT)与回收(->FREE)持tq写锁,持读锁遍历任务表时槽不会被回收或重新分配
+  遍历时可以不加任务锁先比较pid,命中后再加锁复查状态,多个遍历者之间不互斥
+  锁序: wait_lock -> tq -> 任务锁
+*/
+INIT_RWLOCK(tq);
+INIT_SPINLOCK(wait_lock); // 保护子进程退出与父进程wait之间的同步
 struct task task_queue[NPROC];
 
 INIT_SPINLOCK(ti);
-static u32 tidmap[1 + NPROC / sizeof(u32) / 8] = { 0 };
+static u32 tidmap[1 + NPROC / 32] = { 0 };
 static void
 free_tid(u16 tid)
 {
   spin_get(&ti);
-  tidmap[(tid - 1) / sizeof(u32)] &= ~(1U << (tid - 1) % sizeof(u32));
+  tidmap[(tid - 1) / 32] &= ~(1U << (tid - 1) % 32);
   spin_put(&ti);
 }
 static u16
@@ -32,7 +41,7 @@ alloc_tid(void)
       break;
   for (int j = 0; j < 32; ++j)
     if ((tidmap[i] & (1U << j)) == 0) {
-      r = i * sizeof(u32) + j + 1;
+      r = i * 32 + j + 1;
       tidmap[i] |= (1U << j);
       break;
     }
@@ -40,25 +49,29 @@ alloc_tid(void)
   return r;
 }
 
+static struct file*
+copy_file(struct file* pf)
+{
+  struct file* f = falloc();
+  f->type = pf->type;
+  f->mode = pf->mode;
+  f->inode = pf->inode; // union !
+  if (f->type == INODE || f->type == DEVICE)
+    iref(f->inode);
+  else if (f->type == PIPE)
+    pipeget(f->pipe);
+  return f;
+}
+
 static void
 copy_fs(struct task* c, struct task* p)
 {
   iref(p->fs_struct->cwd);
   memcpy(c->fs_struct, p->fs_struct, sizeof(struct fs_struct));
-  for (u32 i = 0; i < NFILE; ++i) {
-    struct file* pf = c->fs_struct->files[i];
-    if (pf) {
-      struct file* f = falloc();
-      f->type = pf->type;
-      f->mode = pf->mode;
-      f->inode = pf->inode; // union !
-      if (f->type == INODE || f->type == DEVICE)
-        iref(f->inode);
-      else if (f->type == PIPE)
-        pipeget(f->pipe);
-      c->fs_struct->files[i] = f;
-    }
-  }
+  c->fs_struct->ref = 1;
+  for (u32 i = 0; i < NFILE; ++i)
+    if (c->fs_struct->files[i])
+      c->fs_struct->files[i] = copy_file(c->fs_struct->files[i]);
 }
 
 static void
@@ -69,28 +82,71 @@ task_info_init(struct task* t, struct task* p)
   t->pid = t->tid = alloc_tid();
   t->parent = p;
   list_init(&t->childs);
+  t->cpu = cpuid(); // 新任务先放入创建者所在cpu的运行队列
+  task_set_nice(t, p ? p->nice : 0);
+  t->policy = p ? p->policy : SCHED_NORMAL;
+  t->rt_prio = p ? p->rt_prio : 0;
+  t->preempt_off = 0;
+  t->cpumask = p ? p->cpumask : CPUMASK_ALL;
+  t->vruntime = p ? p->vruntime : 0;
+  t->uarg = 0;
+  t->sum_exec = t->sum_wait = 0;
+  t->woken = false;
+  t->killed = false;
+  t->nvcsw = t->nivcsw = 0;
+  fp_init(t);
+}
+
+/*
+  任务资源缓存
+  进程退出释放全部vma后,页表中只剩trapframe与trampoline的映射(根页表及其下两级页表),
+  连同内核栈、trapframe页和mm_struct放入本cpu的缓存,fork与spawn优先从中取用,省去重新分配、清零与映射
+  缓存已满或地址空间由线程最后释放(内核栈不在页链表上)时照常释放
+*/
+static bool
+res_get(struct task* t)
+{
+  push_intr();
+  struct cpu* c = mycpu();
+  bool hit = c->nres > 0;
+  if (hit) {
+    struct task_res* r = &c->res_cache[--c->nres];
+    t->mm_struct = r->mm;
+    t->pagetable = r->pagetable;
+    t->kstack = r->kstack;
+  }
+  pop_intr();
+  return hit;
 }
 
+static bool
+res_put(struct task* t)
+{
+  struct mm_struct* tm = t->mm_struct;
+  if (is_thread(t) || tm->nptable != 3) // 仍有用户页表页时不缓存
+    return false;
+  push_intr();
+  struct cpu* c = mycpu();
+  bool put = c->nres < NTASKRES;
+  if (put)
+    c->res_cache[c->nres++] = (struct task_res){ .mm = tm, .pagetable = t->pagetable, .kstack = t->kstack };
+  pop_intr();
+  return put;
+}
+
+// 分配mm_struct、根页表、内核栈与trapframe页,并映射trapframe与trampoline
 static void
-task_mm_init(struct task* t, struct task* p)
+res_alloc(struct task* t)
 {
-  struct mm_struct *tm = alloc_mm_struct_slot(), *pm = p ? p->mm_struct : NULL;
+  struct mm_struct* tm = alloc_mm_struct_slot();
   t->mm_struct = tm;
   list_init(&tm->vma_head);
   list_init(&tm->page_head);
-  tm->next_heap = p ? pm->next_heap : 0;
 
   // 分配页表
   struct page* page = alloc_page_for_task(t);
   t->pagetable = (pagetable_t)page->paddr;
-  t->ustack = USTACK + PGSIZE;
-
-  if (p) {
-    copy_pagetable(t, p);
-  } else {
-    page = alloc_page_for_task(t);
-    task_vmmap(t, USTACK, page->paddr, PGSIZE, PTE_R | PTE_W | PTE_U, STACK);
-  }
+  tm->nptable = 1;
 
   // 分配内核栈
   page = alloc_page_for_task(t);
@@ -100,16 +156,43 @@ task_mm_init(struct task* t, struct task* p)
   page = alloc_page_for_task(t);
   ((struct trapframe*)page->paddr)->ksatp = kernel_satp;
   svmmap(t->pagetable, TRAPFRAME, page->paddr, PGSIZE, PTE_R, t);
+  tm->nkstack = 2;
 
   // 映射trampoline页 |  TRAMPOLINE页必须在内核和用户的页表中虚拟地址必须相同 | 该页所有task共享
   extern char trampoline[];
   svmmap(t->pagetable, TRAMPOLINE, (u64)trampoline, PGSIZE, PTE_X | PTE_R, NULL);
 }
 
+static void
+task_mm_init(struct task* t, struct task* p)
+{
+  if (! res_get(t))
+    res_alloc(t);
+  struct mm_struct *tm = t->mm_struct, *pm = p ? p->mm_struct : NULL;
+  tm->next_heap = p ? pm->next_heap : 0;
+  tm->next_mmap = p ? pm->next_mmap : MMAP_BASE;
+  for (int i = 0; i < NVMA_TYPE; ++i)
+    tm->rss[i] = 0;
+  tm->nvma = 0;
+  tm->ref = 1;
+  tm->lock = (struct sleeplock){ .lname = "mm-lock", .locked = false, .task = NULL };
+  t->ustack = USTACK + PGSIZE;
+
+  if (p) {
+    sleep_get(&pm->lock); // 父进程的其他线程可能正在修改地址空间
+    copy_pagetable(t, p);
+    sleep_put(&pm->lock);
+  } else {
+    struct page* page = alloc_page_for_task(t);
+    task_vmmap(t, USTACK, page->paddr, PGSIZE, PTE_R | PTE_W | PTE_U, STACK);
+  }
+}
+
 static void
 task_fs_init(struct task* t, struct task* p)
 {
   t->fs_struct = alloc_fs_struct_slot();
+  t->fs_struct->ref = 1;
   if (p == NULL)
     return;
   copy_fs(t, p);
@@ -119,51 +202,274 @@ static void
 task_init(struct task* t, struct task* p)
 {
   task_info_init(t, p);
+  if (p)
+    fp_fork(t, p);
   task_mm_init(t, p);
   task_fs_init(t, p);
 }
 
-struct task*
-alloc_task(struct task* p)
+// 任务槽用尽时返回NULL
+static struct task*
+task_slot(void)
 {
-  spin_get(&tq);
+  rw_wget(&tq);
   for (int i = 0; i < NPROC; ++i) {
     spin_get(&task_queue[i].lock);
     if (task_queue[i].state == FREE) {
       task_queue[i].state = INIT;
       spin_put(&task_queue[i].lock);
-      spin_put(&tq);
-      task_init(task_queue + i, p);
+      rw_wput(&tq);
       return task_queue + i;
     }
     spin_put(&task_queue[i].lock);
   }
-  panic("alloc_task: task too much");
+  rw_wput(&tq);
+  return NULL;
 }
 
+struct task*
+alloc_task(struct task* p)
+{
+  struct task* t = task_slot();
+  if (t == NULL)
+    return NULL;
+  task_init(t, p);
+  return t;
+}
+
+/*
+  创建进程p的线程: 共享页表、mm_struct与fs_struct,pid与p相同,tid独立
+  内核栈单独分配,不挂在mm_struct的页链表上,由join回收;用户栈由调用方提供
+  线程从entry开始执行,a0为arg,sp为ustack
+*/
+struct task*
+alloc_thread(struct task* p, u64 entry, u64 ustack, u64 arg)
+{
+  extern void first_sched(void);
+  struct task* t = task_slot();
+  if (t == NULL)
+    return NULL;
+  task_info_init(t, p);
+  t->pid = p->pid;
+  strcpy(t->tname, p->tname);
+
+  t->mm_struct = p->mm_struct;
+  t->pagetable = p->pagetable;
+  t->fs_struct = p->fs_struct;
+  __sync_fetch_and_add(&t->mm_struct->ref, 1);
+  __sync_fetch_and_add(&t->fs_struct->ref, 1);
+
+  t->kstack = alloc_page()->paddr + PGSIZE;
+  __sync_fetch_and_add(&t->mm_struct->nkstack, 1);
+
+  t->entry = entry;
+  t->ustack = ustack;
+  t->uarg = arg;
+  t->ctx.ra = (u64)first_sched;
+  t->ctx.sp = t->kstack;
+  spin_get(&t->lock);
+  task_ready(t);
+  spin_put(&t->lock);
+  return t;
+}
+
+/*
+  创建内核线程: 使用内核页表,只分配内核栈,不属于任何进程
+  线程从fn(arg)开始在内核态运行,fn不能返回;调用方设置cpumask后通过task_ready使其就绪
+*/
+struct task*
+alloc_kthread(void (*fn)(void*), void* arg, const char* name)
+{
+  extern void kthread_entry(void);
+  extern pagetable_t kernel_pgt;
+  struct task* t = task_slot();
+  if (t == NULL)
+    panic("alloc_kthread: task too much");
+  task_info_init(t, NULL);
+  strcpy(t->tname, name);
+  t->mm_struct = NULL;
+  t->fs_struct = NULL;
+  t->pagetable = kernel_pgt;
+  t->kstack = alloc_page()->paddr + PGSIZE;
+  t->entry = (u64)fn;
+  t->uarg = (u64)arg;
+  t->ctx.ra = (u64)kthread_entry;
+  t->ctx.sp = t->kstack;
+  return t;
+}
+
+/*
+  spawn: 由p直接创建运行可执行文件f的子进程,不复制p的地址空间、内核栈与文件表
+  子进程的文件i复制自files[i](共nfd个,调用方持有其引用),files为NULL时继承p的全部文件;工作目录与p相同
+  option非空时与exec一样放在用户栈顶,作为main的参数
+*/
+struct task*
+alloc_spawn(struct task* p, struct file* f, struct elfhdr* eh, const char* option, struct file* const* files, int nfd)
+{
+  extern void first_sched(void);
+  struct task* t = task_slot();
+  if (t == NULL)
+    return NULL;
+  task_info_init(t, p);
+  task_mm_init(t, NULL);
+
+  struct fs_struct* fs = t->fs_struct = alloc_fs_struct_slot();
+  memset(fs, 0, sizeof(struct fs_struct));
+  fs->ref = 1;
+  iref(p->fs_struct->cwd);
+  fs->cwd = p->fs_struct->cwd;
+  if (files) {
+    for (int i = 0; i < nfd; ++i)
+      fs->files[i] = copy_file(files[i]);
+    fs->fdx = nfd;
+  } else {
+    for (int i = 0; i < NFILE; ++i)
+      if (p->fs_struct->files[i])
+        fs->files[i] = copy_file(p->fs_struct->files[i]);
+    fs->fdx = p->fs_struct->fdx;
+  }
+
+  if (option) {
+    int opsize = strlen(option) + 1;
+    t->ustack -= align_up(opsize, 16);
+    memcpy((void*)va_to_pa(t->pagetable, t->ustack, NULL), option, opsize);
+    t->uarg = t->ustack;
+  }
+  load_segment(t, f, eh);
+  t->entry = eh->entry;
+  t->ctx.ra = (u64)first_sched;
+  t->ctx.sp = t->kstack;
+  return t;
+}
+
+// 查找进程pid中尚未回收的线程tid,调用方需持有wait_lock
+struct task*
+thread_find(u16 pid, u16 tid)
+{
+  struct task* r = NULL;
+  rw_rget(&tq);
+  for (int i = 0; i < NPROC; ++i) {
+    struct task* t = &task_queue[i];
+    if (t->state != FREE && t->state != INIT && t->pid == pid && t->tid == tid && is_thread(t)) {
+      r = t;
+      break;
+    }
+  }
+  rw_rput(&tq);
+  return r;
+}
+
+// 回收已退出的进程,其资源已在退出时释放,调用方持有wait_lock
+void
+free_task(struct task* t)
+{
+  rw_wget(&tq);
+  spin_get(&t->lock);
+  t->state = FREE;
+  spin_put(&t->lock);
+  rw_wput(&tq);
+}
+
+// 回收已退出的线程: 释放内核栈与tid,调用方持有wait_lock
+void
+free_thread(struct task* t)
+{
+  rw_wget(&tq);
+  spin_get(&t->lock); //! 线程退出时持有自身锁直到切换离开,此后才能释放其内核栈
+  free_page(page(t->kstack - PGSIZE));
+  __sync_fetch_and_sub(&t->mm_struct->nkstack, 1); // 调用方与t共享地址空间,mm_struct仍有效
+  free_tid(t->tid);
+  t->state = FREE;
+  spin_put(&t->lock);
+  rw_wput(&tq);
+}
+
+// 孤儿进程交给init
+void
+orphan_childs(struct task* t)
+{
+  struct list_node* child = t->childs.next;
+  while (child != &t->childs) {
+    struct task* c = container_of(child, struct task, self);
+    child = child->next;
+    spin_get(&c->lock);
+    c->parent = &task_queue[0];
+    list_remove(&c->self);
+    list_pushback(&task_queue[0].childs, &c->self);
+    spin_put(&c->lock);
+  }
+}
+
+// 标记线程t结束,正在可中断睡眠的t被唤醒
 static void
+kill_thread(struct task* t)
+{
+  spin_get(&t->lock);
+  t->killed = true;
+  void* chan = t->state == SLEEP ? t->chan : NULL;
+  spin_put(&t->lock);
+  if (chan)
+    wakeup(chan); //! 不能持有t->lock: wakeup先获取等待队列锁再获取任务锁
+}
+
+/*
+  进程(主线程p)退出前结束并回收其余尚未join的线程,此后地址空间由p最后释放
+  线程在返回用户态前或可中断的睡眠中自行退出;其他线程可能同时在创建新线程,因此反复扫描直到没有剩余
+*/
+void
+exit_threads(struct task* p)
+{
+  spin_get(&wait_lock);
+  bool found = true;
+  while (found) {
+    found = false;
+    for (int i = 0; i < NPROC; ++i) {
+      struct task* t = &task_queue[i];
+      if (t == p || t->pid != p->pid || ! is_thread(t) || t->state == FREE || t->state == INIT)
+        continue;
+      found = true;
+      kill_thread(t);
+      while (t->pid == p->pid && is_thread(t) && t->state != EXIT && t->state != FREE)
+        sleep(t, &wait_lock); // 线程退出时唤醒t
+      if (t->pid == p->pid && is_thread(t) && t->state == EXIT)
+        free_thread(t);
+    }
+  }
+  spin_put(&wait_lock);
+}
+
+// 返回地址空间是否已随最后一个使用者释放
+static bool
 clean_mm_source(struct task* t)
 {
-  struct list_node* node = t->mm_struct->page_head.next;
+  if (__sync_sub_and_fetch(&t->mm_struct->ref, 1))
+    return false;
+  // 先释放vma: 文件映射的脏页回写需要访问尚未释放的页表与物理页
+  struct list_node* node = t->mm_struct->vma_head.next;
+  while (node != &t->mm_struct->vma_head) {
+    struct vma* vma = container_of(node, struct vma, node);
+    node = node->next;
+    vma_free(t, vma);
+  }
+  if (res_put(t))
+    return true;
+  node = t->mm_struct->page_head.next;
   while (node != &t->mm_struct->page_head) {
     struct page* p = container_of(node, struct page, page_node);
     node = node->next;
     free_page_for_task(p);
   }
-  node = t->mm_struct->vma_head.next;
-  while (node != &t->mm_struct->vma_head) {
-    struct vma* vma = container_of(node, struct vma, node);
-    node = node->next;
-    list_remove(&vma->node);
-    free_vma_slot(vma);
-  }
   free_mm_struct_slot(t->mm_struct);
+  return true;
 }
 static void
 clean_fs_source(struct task* t)
 {
   struct fs_struct* fs_struct = t->fs_struct;
   struct file** files = fs_struct->files;
+  t->fs_struct = NULL;
+  if (__sync_sub_and_fetch(&fs_struct->ref, 1))
+    return;
 
   iput(fs_struct->cwd);
   fs_struct->cwd = NULL;
@@ -176,17 +482,17 @@ clean_fs_source(struct task* t)
   fs_struct->fdx = 0;
 
   free_fs_struct_slot(fs_struct);
-  t->fs_struct = NULL;
 }
 void
 clean_source(struct task* t)
 {
+  fp_release(t);
   clean_fs_source(t);
-  clean_mm_source(t);
-  free_tid(t->tid);
+  if (clean_mm_source(t)) // pid在最后一个共享地址空间的任务退出时释放,线程自己的tid由join释放
+    free_tid(t->pid);
 }
 
-// 清空代码段,数据段和堆区
+// 清空代码段,数据段,堆区和文件映射区
 void
 reset_vma(struct task* t)
 {
@@ -194,23 +500,96 @@ reset_vma(struct task* t)
   while (node != &t->mm_struct->vma_head) {
     struct vma* vma = container_of(node, struct vma, node);
     node = node->next;
-    if (vma->type != STACK) {
-      list_remove(&vma->node);
-      free_vma_slot(vma);
-    }
+    if (vma->type != STACK)
+      vma_free(t, vma);
   }
+  t->mm_struct->next_mmap = MMAP_BASE;
 }
 
 void
 dump_all_task(void)
 {
+  extern struct cpu cpus[NCPU];
+  u64 now = r_time();
+  for (int i = 0; i < NCPU; ++i) {
+    struct cpu* c = &cpus[i];
+    if (c->boot_time == 0) // 未启动的cpu
+      continue;
+    u64 total = now - c->boot_time, idle = c->idle_time;
+    print("cpu%d idle %d% busy %d%\n", i, (int)(idle * 100 / total), (int)(100 - idle * 100 / total));
+  }
+
   print("\npid tid state name\n");
+  rw_rget(&tq);
   for (int i = 0; i < NPROC; ++i) {
     struct task* t = &task_queue[i];
     spin_get(&t->lock);
-    if (t->state == READY || t->state == RUN || t->state == SLEEP)
+    if (t->state == READY || t->state == RUN || t->state == SLEEP) {
       print("%d  %d  %s %s\n", t->pid, t->tid, t->state == READY ? "READY" : (t->state == RUN ? "RUN" : "SLEEP"),
             t->tname);
+      if (! is_kthread(t)) {
+        u32* rss = t->mm_struct->rss;
+        print("    rss: text %d data %d heap %d stack %d mmap %d\n", rss[TEXT], rss[DATA], rss[HEAP], rss[STACK],
+              rss[MMAP]);
+        print("    ptable %d kstack %d\n", t->mm_struct->nptable, t->mm_struct->nkstack);
+      }
+      print("    exec %dms wait %dms vcsw %d ivcsw %d\n", (int)(t->sum_exec / (TIMEBASE_FREQ / 1000)),
+            (int)(t->sum_wait / (TIMEBASE_FREQ / 1000)), t->nvcsw, t->nivcsw);
+    }
     spin_put(&t->lock);
   }
+  rw_rput(&tq);
+  dump_latency();
+}
+
+/*
+  查找存活的任务pid(0表示当前任务),找到时返回的任务已加锁,由调用方释放
+  按tid匹配: 进程号即主线程的tid,同一进程的线程共享pid,按pid匹配可能找到其他线程
+*/
+struct task*
+task_get(u16 pid)
+{
+  if (pid == 0) {
+    struct task* t = mytask();
+    spin_get(&t->lock);
+    return t;
+  }
+  rw_rget(&tq);
+  for (int i = 0; i < NPROC; ++i) {
+    struct task* t = &task_queue[i];
+    if (t->tid != pid || t->state == FREE || t->state == INIT) // 无锁预判
+      continue;
+    spin_get(&t->lock);
+    if (t->tid == pid && (t->state == READY || t->state == RUN || t->state == SLEEP)) {
+      rw_rput(&tq);
+      return t;
+    }
+    spin_put(&t->lock);
+  }
+  rw_rput(&tq);
+  return NULL;
+}
+
+// 获取进程pid(0表示当前进程)的常驻内存统计
+bool
+task_memstat(u16 pid, struct memstat* ms)
+{
+  struct task* t = task_get(pid);
+  if (t == NULL)
+    return false;
+  if (is_kthread(t)) {
+    spin_put(&t->lock);
+    return false;
+  }
+
+  struct mm_struct* mm = t->mm_struct;
+  ms->text = mm->rss[TEXT];
+  ms->data = mm->rss[DATA];
+  ms->heap = mm->rss[HEAP];
+  ms->stack = mm->rss[STACK];
+  ms->mmap = mm->rss[MMAP];
+  ms->pgtable = mm->nptable;
+  ms->kstack = mm->nkstack;
+  spin_put(&t->lock);
+  return true;
 }
\ No newline at end of file
@@ -6,9 +6,22 @@
 #include "task/cpu.h"
 #include "fs/file.h"
 #include "mem/vm.h"
+#include "task/fpu.h"
 
 struct inode;
 
+#define CPU_BIT(id) (1UL << (id))
+#define CPUMASK_ALL (~0UL >> (64 - NCPU))
+static_assert(NCPU <= 64, "cpumask is a u64");
+
+// 遍历mask中的每个cpu
+#define for_each_cpu(i, mask) for (u64 _m = (mask), i; _m && (i = __builtin_ctzl(_m), 1); _m &= _m - 1)
+
+// 线程与创建它的进程共享pid,tid各自独立;进程的tid等于pid
+#define is_thread(t) ((t)->tid != (t)->pid)
+// 内核线程只在内核态运行,没有用户地址空间与文件表
+#define is_kthread(t) ((t)->mm_struct == NULL)
+
 enum task_state {
   FREE,
   INIT,
@@ -26,11 +39,13 @@ struct fs_struct {
   struct file* files[NFILE];
   u32 fdx;
   struct inode* cwd;
+  u32 ref; // 共享该文件表的任务数
 };
 
 struct task {
   u64 entry; // 进程代码入口地址
   u64 ustack;
+  u64 uarg; // 首次进入用户态时的a0: exec的选项字符串或线程参数
   u64 kstack;
   pagetable_t pagetable;
 
@@ -42,16 +57,60 @@ struct task {
   struct list_node self;
 
   int exit_code;
-  void* chan; // 等待事件
+  bool killed; // 所属进程已退出,线程在下次返回用户态前或可中断的睡眠中结束
+  void* chan;  // 等待事件
   enum task_state state;
   struct context ctx;
 
+  struct list_node rq_node;   // READY时挂在某个cpu的运行队列上
+  u16 cpu;                    // 最近运行所在的cpu,唤醒时优先放回该cpu的运行队列
+  struct list_node wait_node; // SLEEP时挂在chan所在的等待队列上
+
+  // 公平调度
+  i8 nice;        // -20~19,越小优先级越高
+  u32 weight;     // 由nice决定的权重
+  u64 vruntime;   // 按权重折算后的累计运行时间
+  u64 exec_start; // 本次开始运行的时间
+
+  // 实时调度
+  u8 policy;  // SCHED_NORMAL/SCHED_FIFO/SCHED_RR
+  u8 rt_prio; // 1~RT_PRIO_MAX,普通任务为0
+
+  u8 preempt_off; // preempt_disable嵌套层数,随任务切换,期间可以睡眠但不会被抢占
+  u64 cpumask;    // 允许运行的cpu集合
+
+  // 调度统计,时间单位为time寄存器计数
+  u64 sum_exec;      // 累计运行时间
+  u64 sum_wait;      // 累计READY但未运行的时间
+  u64 ready_start;   // 最近一次变为READY的时间
+  bool woken;        // 最近一次READY由唤醒引起,开始运行时计入唤醒延迟直方图
+  u32 nvcsw, nivcsw; // 主动/被动切换次数
+
+  // 浮点与向量上下文,惰性保存与载入
+  struct fpstate fp;
+  u16 fp_cpu;         // fp最近一次载入到的cpu,NCPU表示未载入
+  struct vstate* vec; // 首次使用向量指令时分配
+  u16 vec_cpu;        // vec最近一次载入到的cpu
+
   struct fs_struct* fs_struct;
   struct mm_struct* mm_struct;
 
   char tname[16];
 };
 
+extern struct spinlock wait_lock;
+
 struct task* alloc_task(struct task* p);
+struct task* alloc_thread(struct task* p, u64 entry, u64 ustack, u64 arg);
+struct task* alloc_kthread(void (*fn)(void*), void* arg, const char* name);
+struct elfhdr;
+struct task* alloc_spawn(struct task* p, struct file* f, struct elfhdr* eh, const char* option, struct file* const* files, int nfd);
+struct task* thread_find(u16 pid, u16 tid);
+void free_task(struct task* t);
+void free_thread(struct task* t);
+void exit_threads(struct task* p);
+void orphan_childs(struct task* t);
 void clean_source(struct task* t);
-void reset_vma(struct task* t);
\ No newline at end of file
+void reset_vma(struct task* t);
+struct task* task_get(u16 pid);
+bool task_memstat(u16 pid, struct memstat* ms);
\ No newline at end of file
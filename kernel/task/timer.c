@@ -0,0 +1,160 @@
+#include "config.h"
+#include "task/timer.h"
+#include "task/cpu.h"
+#include "task/sche.h"
+#include "util/spinlock.h"
+
+/*
+  head与first持lock修改;tick与slice_end只由本cpu在关中断时访问,不加锁
+  调度器在持有任务锁时设置时间片,而定时器回调在持有队列锁时获取等待队列锁与任务锁,
+  因此调度器一侧不能获取队列锁,只读取first
+*/
+struct timerq {
+  struct spinlock lock;
+  struct list_node head;
+  u64 first;     // 队首定时器的到期时间,队列为空时为~0
+  bool tick;     // 有任务运行,需要时间片时钟
+  u64 slice_end; // 时间片到期时间
+} __attribute__((aligned(CACHE_LINE)));
+static struct timerq timerqs[NCPU];
+
+void
+init_timerq(void)
+{
+  for (int i = 0; i < NCPU; ++i) {
+    timerqs[i].lock.lname = "timerq-lock";
+    list_init(&timerqs[i].head);
+    timerqs[i].first = ~0UL;
+    timerqs[i].tick = false;
+  }
+}
+
+// 队列改变后更新first,调用方持有q->lock
+static void
+update_first(struct timerq* q)
+{
+  q->first = q->head.next != &q->head ? container_of(q->head.next, struct timer, node)->expires : ~0UL;
+}
+
+/*
+  按最近的定时器与时间片设置本cpu的stimecmp,由本cpu在关中断时调用
+  其他cpu的timer_del可能同时改变first,读到的旧值只会让时钟中断提前到来
+*/
+static void
+program(struct timerq* q)
+{
+  u64 next = q->first;
+  if (q->tick)
+    next = min(next, q->slice_end);
+  w_stimecmp(next);
+}
+
+// 在当前cpu上添加一个在expires时刻到期的定时器
+void
+timer_add(struct timer* tm, u64 expires)
+{
+  push_intr(); //! 取得队列与设置stimecmp必须在同一个cpu上
+  struct timerq* q = &timerqs[cpuid()];
+  spin_get(&q->lock);
+  tm->expires = expires;
+  tm->cpu = cpuid();
+  tm->pending = true;
+  struct list_node* node = q->head.next;
+  while (node != &q->head && container_of(node, struct timer, node)->expires <= expires)
+    node = node->next;
+  list_pushback(node, &tm->node); // 插入到node之前
+  if (q->head.next == &tm->node) {
+    update_first(q);
+    program(q);
+  }
+  spin_put(&q->lock);
+  pop_intr();
+}
+
+// 删除尚未到期的定时器,不重新设置stimecmp,提前到来的时钟中断没有副作用
+void
+timer_del(struct timer* tm)
+{
+  struct timerq* q = &timerqs[tm->cpu];
+  spin_get(&q->lock);
+  if (tm->pending) {
+    list_remove(&tm->node);
+    tm->pending = false;
+    update_first(q);
+  }
+  spin_put(&q->lock);
+}
+
+/*
+  开关本cpu的时间片时钟: 运行任务时打开,空闲时关闭,空闲cpu只在定时器到期时被时钟中断唤醒
+  ! 由调度器在关中断时调用,不获取队列锁
+*/
+void
+timer_tick(bool on)
+{
+  struct timerq* q = &timerqs[cpuid()];
+  if (q->tick == on)
+    return;
+  q->tick = on;
+  if (on)
+    q->slice_end = r_time() + TIME_CYCLE;
+  program(q);
+}
+
+// 本cpu的当前时间片不晚于end到期,由调度器在关中断时调用,不获取队列锁
+void
+timer_slice(u64 end)
+{
+  struct timerq* q = &timerqs[cpuid()];
+  if (end < q->slice_end) {
+    q->slice_end = end;
+    program(q);
+  }
+}
+
+// 时钟中断: 执行本cpu所有到期的定时器并重新设置stimecmp,返回时间片是否到期
+bool
+timer_interrupt(void)
+{
+  struct timerq* q = &timerqs[cpuid()];
+  spin_get(&q->lock);
+  u64 now = r_time();
+  bool expired = q->tick && now >= q->slice_end;
+  if (expired)
+    q->slice_end = now + TIME_CYCLE;
+  while (q->head.next != &q->head) {
+    struct timer* tm = container_of(q->head.next, struct timer, node);
+    if (tm->expires > now)
+      break;
+    list_remove(&tm->node);
+    tm->pending = false;
+    tm->fn(tm);
+  }
+  update_first(q);
+  program(q);
+  spin_put(&q->lock);
+  return expired;
+}
+
+static void
+sleep_timeout(struct timer* tm)
+{
+  wakeup(tm);
+}
+
+// 当前任务睡眠到expires时刻
+void
+sleep_until(u64 expires)
+{
+  struct timer tm = { .fn = sleep_timeout };
+  timer_add(&tm, expires);
+  struct spinlock* lock = &timerqs[tm.cpu].lock;
+  spin_get(lock);
+  bool alive = true;
+  while (tm.pending && alive)
+    alive = sleep_killable(&tm, lock); //! 检查pending与进入睡眠之间持有队列锁,定时器到期不会丢失唤醒
+  spin_put(lock);
+  if (! alive)
+    timer_del(&tm); // tm在栈上,提前返回前必须撤下
+
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "types.h"
+#include "util/list.h"
+
+/*
+  定时器: 每个cpu一个按到期时间升序排列的定时器队列
+  stimecmp总是被设置为最近的到期时间,有任务运行时再与时间片到期时间取较小者(动态时钟)
+  到期时间的单位为time寄存器的计数
+*/
+struct timer {
+  struct list_node node;
+  u64 expires;
+  void (*fn)(struct timer* tm); // 在时钟中断中持有定时器队列锁调用,不可睡眠
+  void* arg;
+  u16 cpu;      // 所在定时器队列
+  bool pending; // 已加入队列且尚未到期
+};
+
+void init_timerq(void);
+void timer_add(struct timer* tm, u64 expires);
+void timer_del(struct timer* tm);
+void timer_tick(bool on);
+void timer_slice(u64 end);
+bool timer_interrupt(void);
+void sleep_until(u64 expires);
@@ -0,0 +1,97 @@
+#include "config.h"
+#include "task/workqueue.h"
+#include "task/task.h"
+#include "task/sche.h"
+#include "util/spinlock.h"
+#include "util/string.h"
+#include "mem/alloc.h"
+
+struct work {
+  struct list_node node;
+  void (*fn)(void*);
+  void* arg;
+};
+
+struct workqueue {
+  struct spinlock lock;
+  struct list_node head;    // 待执行的work
+  struct list_node free;    // 空闲的work
+  struct work works[NWORK]; // 固定大小,中断处理中提交时无需分配内存
+};
+static_assert(sizeof(struct workqueue) <= PGSIZE, "workqueue must fit in a page");
+static struct workqueue* wqs[NCPU]; // 只为已启动的cpu分配
+
+/*
+  在当前cpu的工作队列中提交fn(arg),可以在中断处理中调用
+  队列已满时返回false,由调用方自行同步完成
+*/
+bool
+queue_work(void (*fn)(void*), void* arg)
+{
+  push_intr(); //! 取得队列与入队必须在同一个cpu上
+  struct workqueue* wq = wqs[cpuid()];
+  if (wq == NULL) { // 本cpu尚未开始调度
+    pop_intr();
+    return false;
+  }
+  spin_get(&wq->lock);
+  bool ok = wq->free.next != &wq->free;
+  if (ok) {
+    struct work* w = container_of(wq->free.next, struct work, node);
+    list_remove(&w->node);
+    w->fn = fn;
+    w->arg = arg;
+    list_pushback(&wq->head, &w->node);
+  }
+  spin_put(&wq->lock);
+  if (ok)
+    wakeup_one(wq);
+  pop_intr();
+  return ok;
+}
+
+static void
+kworker(void* arg)
+{
+  struct workqueue* wq = arg;
+  while (1) {
+    spin_get(&wq->lock);
+    while (wq->head.next == &wq->head)
+      sleep(wq, &wq->lock);
+    struct work* w = container_of(wq->head.next, struct work, node);
+    list_remove(&w->node);
+    void (*fn)(void*) = w->fn;
+    void* warg = w->arg;
+    list_pushback(&wq->free, &w->node);
+    spin_put(&wq->lock);
+    fn(warg);
+  }
+}
+
+// 为当前cpu分配工作队列并创建工作线程,各cpu开始调度前调用
+void
+init_kworker(void)
+{
+  u64 id = cpuid();
+  struct workqueue* wq = (struct workqueue*)alloc_page()->paddr;
+  wq->lock.lname = "workqueue-lock";
+  list_init(&wq->head);
+  list_init(&wq->free);
+  for (int j = 0; j < NWORK; ++j)
+    list_pushback(&wq->free, &wq->works[j].node);
+
+  char name[16] = "kworker/";
+  int n = 8;
+  if (id >= 10)
+    name[n++] = '0' + id / 10;
+  name[n] = '0' + id % 10;
+  for (int i = 0; i < NKWORKER; ++i) {
+    struct task* t = alloc_kthread(kworker, wq, name);
+    t->cpumask = CPU_BIT(id);
+    spin_get(&t->lock);
+    task_ready(t);
+    spin_put(&t->lock);
+  }
+  __sync_synchronize();
+  wqs[id] = wq;
+}
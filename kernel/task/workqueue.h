@@ -0,0 +1,11 @@
+#pragma once
+#include "types.h"
+
+/*
+  工作队列: 把不必在系统调用或中断处理中同步完成的工作推迟给内核工作线程
+  每个cpu一个队列与NKWORKER个绑定在该cpu上的工作线程,work在提交它的cpu上按提交顺序开始执行
+  队列在cpu开始调度前才分配,此前提交会失败
+  work函数运行在内核线程中,可以睡眠,但没有用户地址空间与文件表(只能使用绝对路径)
+*/
+void init_kworker(void);
+bool queue_work(void (*fn)(void*), void* arg);
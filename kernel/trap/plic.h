@@ -29,28 +29,31 @@
 #define PLIC_PRIORITY(irq) (volatile u32*)(PLIC_BASE + (irq << 2))
 
 /*
-  中断使能位：每个处理器内核都有对应的中断使能位
-  只使用监管模式的上下文
+  上下文: QEMU virt中每个hart有M模式与S模式两个上下文,hart n的S模式上下文编号为2n+1
+  只使用监管模式的上下文,上下文数随hart数增长(64个hart共128个上下文,仍在PLIC_SIZE之内)
+*/
+#define PLIC_SCONTEXT(hartid) (2 * (u64)(hartid) + 1)
+
+/*
+  中断使能位：每个上下文0x80字节,每一个bit对应一个IRQ使能
   ! 0xC0002000~0xC01FFFFC
-  0号核S-context 0xC0002080 (每一个bit对应一个IRQ使能)
+  0号核S-context 0xC0002080
   1号核S-context 0xC0002180
 */
-// #define PLIC_ENABLE(hartid) (volatile u32*)(PLIC_BASE + 0x2000 + hartid * 0x100 + 0x80)
-#define PLIC_ENABLE(hartid) (volatile u32*)(PLIC_BASE + 0x2000 + (hartid << 8) + 0x80)
+#define PLIC_ENABLE(hartid) (volatile u32*)(PLIC_BASE + 0x2000 + PLIC_SCONTEXT(hartid) * 0x80)
 
 /*
   设置每个处理器中断的优先级阈值，当中断优先级大于阈值才会触发中断
-  只使用监管模式的阈值
+  每个上下文0x1000字节,只使用监管模式的阈值
 */
-// #define PLIC_THRESHOLD(hartid) (volatile u32*)(PLIC_BASE + 0x200000 + hartid * 0x2000 + 0x1000)
-#define PLIC_THRESHOLD(hartid) (volatile u32*)(PLIC_BASE + 0x200000 + (hartid << 13) + 0x1000)
+#define PLIC_THRESHOLD(hartid) (volatile u32*)(PLIC_BASE + 0x200000 + PLIC_SCONTEXT(hartid) * 0x1000)
 
 /*
   请求/完成寄存器
   只使用监管模式
 */
-#define PLIC_CLAIM(hartid)     (volatile u32*)(PLIC_BASE + 0x200000 + (hartid << 13) + 0x1004)
-#define PLIC_COMPETION(hartid) (volatile u32*)(PLIC_BASE + 0x200000 + (hartid << 13) + 0x1004)
+#define PLIC_CLAIM(hartid)     (volatile u32*)(PLIC_BASE + 0x200000 + PLIC_SCONTEXT(hartid) * 0x1000 + 4)
+#define PLIC_COMPETION(hartid) (volatile u32*)(PLIC_BASE + 0x200000 + PLIC_SCONTEXT(hartid) * 0x1000 + 4)
 
 #define IRQ_NONE  0
 #define IRQ_DISK  1
@@ -89,7 +92,7 @@ set_plic_my_enable(u32 irq, bool enable)
   u32 index = irq / 32;
   u32 bit = irq % 32;
 
-  volatile u32* reg = (PLIC_ENABLE(cpuid()) + index * 4);
+  volatile u32* reg = PLIC_ENABLE(cpuid()) + index; // 每个u32对应32个IRQ
   if (enable)
     *reg |= (1 << bit);
   else
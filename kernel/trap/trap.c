@@ -26,6 +26,8 @@ RISC-V trap软件处理流程:
 #include "dev/irqf.h"
 #include "trap/pt_reg.h"
 #include "trap/plic.h"
+#include "task/timer.h"
+#include "task/task.h"
 
 
 #define IS_INTR(scause)   ((scause & (1UL << 63)) != 0)
@@ -41,6 +43,7 @@ extern char trampoline[];
 #define ASY_IPI    1
 #define ASY_TIMER  5
 #define ASY_EXTERN 9
+static void asy_ipi(struct pt_regs*);
 static void asy_timer(struct pt_regs*);
 static void asy_extern(struct pt_regs*);
 
@@ -59,6 +62,8 @@ static void asy_extern(struct pt_regs*);
 #define SYN_LOAD_PAGE_FAULT  13
 #define SYN_STORE_PAGE_FAULT 15
 static void syn_syscall_u(struct pt_regs*);
+static void syn_page_fault(struct pt_regs*);
+static void syn_illegal(struct pt_regs*);
 
 
 static const char* interrupt_name[10] = { [0 ... 9] = "UNKNOW" };
@@ -94,9 +99,14 @@ init_trap(void)
   exception_name[SYN_TEXT_PAGE_FAULT] = "TEXT_PAGE_FAULT";
   exception_name[SYN_LOAD_PAGE_FAULT] = "LOAD_PAGE_FAULT";
   exception_name[SYN_STORE_PAGE_FAULT] = "STORE_PAGE_FAULT";
+  interrupt_funs[ASY_IPI] = asy_ipi;
   interrupt_funs[ASY_TIMER] = asy_timer;
   interrupt_funs[ASY_EXTERN] = asy_extern;
   exception_funs[SYN_SYSCALL_U] = syn_syscall_u;
+  exception_funs[SYN_TEXT_ILLEGAL] = syn_illegal;
+  exception_funs[SYN_TEXT_PAGE_FAULT] = syn_page_fault;
+  exception_funs[SYN_LOAD_PAGE_FAULT] = syn_page_fault;
+  exception_funs[SYN_STORE_PAGE_FAULT] = syn_page_fault;
   w_stvec((u64)ktrap_entry); // ktrap_entry四字节对齐,地址低2位被解读为 Direct模式
 }
 
@@ -117,14 +127,23 @@ do_trap(struct pt_regs* pt)
     interrupt_funs[ec](pt);
   } else {
     ec = min(ec, sizeof(exception_funs) / sizeof(trap_fn) - 1);
+    if (from_user)
+      sti(); // 系统调用与缺页处理期间开中断,内核可被抢占
     exception_funs[ec](pt);
     if (ec == 8) // syscall
       sepc += 4;
   }
 
+  if (from_user && mytask()->killed) { // 所属进程已退出的线程在返回用户态前结束
+    extern void kill(void);
+    sti();
+    kill();
+  }
+
   if (from_user) {
     cli();
     w_stvec((u64)utrap_entry - (u64)trampoline + TRAMPOLINE);
+    sstatus = (sstatus & ~(SSTATUS_FS | SSTATUS_VS)) | fp_user_status(mytask()); // 期间可能已迁移或载入了浮点/向量状态
   }
 
   // sstatus和spec可能会被嵌套异常所修改,sret会清SPP位
@@ -132,15 +151,42 @@ do_trap(struct pt_regs* pt)
   w_sepc(sepc);
 }
 
-u64 tstub;
+/*
+  中断返回前让出cpu: 来自用户态直接让出
+  来自内核态时,被中断的代码开中断(未持有自旋锁)且未禁止抢占才抢占,否则推迟到下一个抢占点
+*/
 static void
-asy_timer(struct pt_regs* pt)
+resched(struct pt_regs* pt)
 {
-  extern void wakeup(void*);
-  w_stimecmp((tstub = r_time()) + TIME_CYCLE);
-  wakeup(&tstub);
-  if ((r_sstatus() & SSTATUS_SPP) == 0)
+  struct cpu* c = mycpu();
+  struct task* t = c->cur_task;
+  c->need_resched = false;
+  if ((pt->sstatus & SSTATUS_SPP) == 0) {
     yield();
+  } else if (t && t->state == RUN) {
+    if ((pt->sstatus & SSTATUS_SPIE) && t->preempt_off == 0)
+      yield();
+    else
+      c->need_resched = true;
+  }
+}
+
+// 核间中断: 把空闲cpu从wfi中唤醒(返回调度器后即会检查运行队列),或要求正在运行的cpu为就绪的实时任务重新调度
+static void
+asy_ipi(struct pt_regs* pt)
+{
+  w_sip(r_sip() & ~SIP_SSIP);
+  ++mycpu()->ipi_seq;
+  if (mycpu()->need_resched)
+    resched(pt);
+}
+
+// 时间片到期
+static void
+asy_timer(struct pt_regs* pt)
+{
+  if (timer_interrupt())
+    resched(pt);
 }
 static void
 asy_extern(struct pt_regs* pt)
@@ -167,3 +213,25 @@ syn_syscall_u(struct pt_regs* pt)
   extern void do_syscall(struct pt_regs * pt);
   do_syscall(pt);
 }
+
+// 用户态缺页: 按需载入或写时标脏,非法访问则终止进程;内核态缺页一定是内核bug
+static void
+syn_page_fault(struct pt_regs* pt)
+{
+  extern void kill(void);
+  if (pt->sstatus & SSTATUS_SPP)
+    unknow_trap(pt);
+  if (! do_page_fault(pt->stval, SCAUSE_EC(pt->scause) == SYN_STORE_PAGE_FAULT))
+    kill();
+}
+
+// 用户态非法指令: 浮点或向量单元未启用时惰性载入其状态后重新执行,否则终止进程
+static void
+syn_illegal(struct pt_regs* pt)
+{
+  extern void kill(void);
+  if (pt->sstatus & SSTATUS_SPP)
+    unknow_trap(pt);
+  if (! fp_trap(mytask(), pt->sstatus, pt->sepc))
+    kill();
+}
@@ -89,6 +89,46 @@ w_mcounteren(u64 x)
   asm volatile("csrw mcounteren, %0" : : "r"(x));
 }
 
+static inline __attribute__((always_inline)) u64
+r_scounteren(void)
+{
+  u64 x;
+  asm volatile("csrr %0, scounteren" : "=r"(x));
+  return x;
+}
+
+static inline __attribute__((always_inline)) void
+w_scounteren(u64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r"(x));
+}
+
+static inline __attribute__((always_inline)) void
+w_mtvec(u64 x)
+{
+  asm volatile("csrw mtvec, %0" : : "r"(x));
+}
+
+static inline __attribute__((always_inline)) void
+w_mscratch(u64 x)
+{
+  asm volatile("csrw mscratch, %0" : : "r"(x));
+}
+
+#define MIE_MSIE (1UL << 3) // M模式软件中断
+static inline __attribute__((always_inline)) u64
+r_mie(void)
+{
+  u64 x;
+  asm volatile("csrr %0, mie" : "=r"(x));
+  return x;
+}
+static inline __attribute__((always_inline)) void
+w_mie(u64 x)
+{
+  asm volatile("csrw mie, %0" : : "r"(x));
+}
+
 // S模式寄存器读写
 static inline __attribute__((always_inline)) void
 w_sepc(u64 x)
@@ -150,9 +190,31 @@ w_sie(u64 x)
   asm volatile("csrw sie, %0" : : "r"(x));
 }
 
-#define SSTATUS_SIE  (1L << 1)
-#define SSTATUS_SPIE (1L << 5)
-#define SSTATUS_SPP  (1L << 8)
+#define SIP_SSIP (1UL << 1)
+static inline __attribute__((always_inline)) u64
+r_sip(void)
+{
+  u64 x;
+  asm volatile("csrr %0, sip" : "=r"(x));
+  return x;
+}
+static inline __attribute__((always_inline)) void
+w_sip(u64 x)
+{
+  asm volatile("csrw sip, %0" : : "r"(x));
+}
+
+#define SSTATUS_SIE      (1L << 1)
+#define SSTATUS_SPIE     (1L << 5)
+#define SSTATUS_SPP      (1L << 8)
+#define SSTATUS_FS       (3L << 13) // 浮点单元状态: Off/Initial/Clean/Dirty,写浮点寄存器后硬件置为Dirty
+#define SSTATUS_FS_OFF   (0L << 13)
+#define SSTATUS_FS_CLEAN (2L << 13)
+#define SSTATUS_FS_DIRTY (3L << 13)
+#define SSTATUS_VS       (3L << 9) // 向量单元状态,含义同FS;未实现V扩展时恒为0
+#define SSTATUS_VS_OFF   (0L << 9)
+#define SSTATUS_VS_CLEAN (2L << 9)
+#define SSTATUS_VS_DIRTY (3L << 9)
 static inline __attribute__((always_inline)) u64
 r_sstatus(void)
 {
@@ -179,6 +241,12 @@ sti(void)
 {
   w_sstatus(r_sstatus() | SSTATUS_SIE);
 }
+// 等待中断,sie中使能的中断挂起即返回(不受sstatus.SIE影响)
+static inline __attribute__((always_inline)) void
+wfi(void)
+{
+  asm volatile("wfi");
+}
 // 获取中断使能状态
 static inline __attribute__((always_inline)) bool
 intr(void)
@@ -0,0 +1,42 @@
+#include "util/rwlock.h"
+#include "util/printf.h"
+#include "task/cpu.h"
+
+void
+rw_rget(struct rwlock* lock)
+{
+  push_intr();
+  while (1) {
+    u32 v = __atomic_load_n(&lock->cnt, __ATOMIC_RELAXED);
+    if ((v & RW_WRITER) == 0
+        && __atomic_compare_exchange_n(&lock->cnt, &v, v + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      return;
+  }
+}
+
+void
+rw_rput(struct rwlock* lock)
+{
+  if ((__atomic_load_n(&lock->cnt, __ATOMIC_RELAXED) & ~RW_WRITER) == 0)
+    panic("rw_rput: cpu%d ~ lock %s", cpuid(), lock->lname);
+  __atomic_fetch_sub(&lock->cnt, 1, __ATOMIC_RELEASE);
+  pop_intr();
+}
+
+void
+rw_wget(struct rwlock* lock)
+{
+  spin_get(&lock->wlock); // 重入检查与关中断由自旋锁完成
+  __atomic_fetch_or(&lock->cnt, RW_WRITER, __ATOMIC_RELAXED);
+  while (__atomic_load_n(&lock->cnt, __ATOMIC_ACQUIRE) != RW_WRITER) // 等待已有的读者退出
+    ;
+}
+
+void
+rw_wput(struct rwlock* lock)
+{
+  if (lock->wlock.cpu != mycpu())
+    panic("rw_wput: cpu%d ~ lock %s", cpuid(), lock->lname);
+  __atomic_fetch_and(&lock->cnt, ~RW_WRITER, __ATOMIC_RELEASE);
+  spin_put(&lock->wlock);
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "types.h"
+#include "util/spinlock.h"
+
+/*
+  读写自旋锁: 多个读者可同时持有,写者独占
+  写者先在wlock上按MCS排队,再置RW_WRITER阻止新读者进入并等待已有读者退出,读者不会饿死写者
+  与自旋锁一样持有期间关中断;读锁不可重入(写者等待时重复获取读锁会死锁)
+*/
+#define RW_WRITER (1U << 31)
+
+struct rwlock {
+  const char* lname;
+  u32 cnt;               // 持有读锁的数目,RW_WRITER位表示写者已持有或正在等待读者退出
+  struct spinlock wlock; // 写者之间互斥
+};
+
+void rw_rget(struct rwlock* lock);
+void rw_rput(struct rwlock* lock);
+void rw_wget(struct rwlock* lock);
+void rw_wput(struct rwlock* lock);
+
+#define INIT_RWLOCK(name) struct rwlock name = { .lname = #name, .cnt = 0, .wlock = { .lname = #name } }
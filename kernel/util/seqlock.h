@@ -0,0 +1,45 @@
+#pragma once
+#include "types.h"
+#include "util/spinlock.h"
+
+/*
+  顺序锁: 读者不加锁,读之前与读之后比较seq,期间有写者修改(seq变化或为奇数)则重读
+  适合读远多于写且读者能容忍读到中间状态再重试的数据,读者不写任何共享缓存行
+  写者之间用自旋锁互斥,修改期间seq为奇数
+*/
+struct seqlock {
+  u32 seq;
+  struct spinlock lock;
+};
+
+static inline __attribute__((always_inline)) u32
+seq_rbegin(struct seqlock* s)
+{
+  u32 v;
+  while ((v = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1) // 写者正在修改
+    ;
+  return v;
+}
+
+// 读取期间是否有写者修改过,为真时读到的数据不可信,需要重读
+static inline __attribute__((always_inline)) bool
+seq_retry(struct seqlock* s, u32 v)
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE); // 数据的读取不能越过对seq的复查
+  return __atomic_load_n(&s->seq, __ATOMIC_RELAXED) != v;
+}
+
+static inline __attribute__((always_inline)) void
+seq_wget(struct seqlock* s)
+{
+  spin_get(&s->lock);
+  __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE); // seq变为奇数先于对数据的修改
+}
+
+static inline __attribute__((always_inline)) void
+seq_wput(struct seqlock* s)
+{
+  __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+  spin_put(&s->lock);
+}
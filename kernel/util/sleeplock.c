@@ -30,5 +30,5 @@ sleep_put(struct sleeplock* lock)
   lock->task = NULL;
   __sync_synchronize();
   __sync_lock_release(&lock->locked, false);
-  wakeup(lock);
+  wakeup_one(lock); // 锁只能被一个任务获得
 }
\ No newline at end of file
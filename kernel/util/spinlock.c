@@ -5,9 +5,11 @@
 static bool
 spin_holding(struct spinlock* lock)
 {
-  return lock->locked == true && lock->cpu == mycpu();
+  return lock->cpu == mycpu(); // 只有持有者会把cpu写为自己
 }
 
+#ifdef SPIN_TAS
+
 void
 spin_get(struct spinlock* lock)
 {
@@ -32,7 +34,69 @@ spin_put(struct spinlock* lock)
   pop_intr();
 }
 
+#else
+
+// 从本cpu的节点池中取一个空闲节点,调用方需关中断
+static struct mcs_node*
+node_get(struct cpu* c, struct spinlock* lock)
+{
+  if (c->spin_used == (1U << NSPINNODE) - 1)
+    panic("spin_get: cpu%d out of mcs nodes ~ lock %s", c->id, lock->lname);
+  int i = __builtin_ctz(~c->spin_used);
+  c->spin_used |= 1U << i;
+  struct mcs_node* n = &c->spin_nodes[i];
+  n->next = NULL;
+  n->wait = true;
+  return n;
+}
+
+void
+spin_get(struct spinlock* lock)
+{
+  push_intr(); // 防止因中断导致锁重入
+  struct cpu* c = mycpu();
+  if (spin_holding(lock))
+    panic("spin_get: cpu%d ~ lock %s", c->id, lock->lname);
+
+  struct mcs_node* n = node_get(c, lock);
+  struct mcs_node* prev = __atomic_exchange_n(&lock->tail, n, __ATOMIC_ACQ_REL);
+  if (prev) { // 排在prev之后,只在自己的节点上自旋
+    __atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&n->wait, __ATOMIC_ACQUIRE))
+      ;
+  }
+  lock->node = n;
+  lock->cpu = c;
+}
+
+void
+spin_put(struct spinlock* lock)
+{
+  struct cpu* c = mycpu();
+  if (! spin_holding(lock))
+    panic("spin_put: cpu%d ~ lock %s", c->id, lock->lname);
+  struct mcs_node* n = lock->node;
+  lock->node = NULL;
+  lock->cpu = NULL;
+
+  struct mcs_node* next = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE);
+  if (next == NULL) {
+    struct mcs_node* expect = n;
+    if (__atomic_compare_exchange_n(&lock->tail, &expect, NULL, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      goto out; // 没有等待者
+    while ((next = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE)) == NULL) // 新的等待者已换入tail但尚未链接到n
+      ;
+  }
+  __atomic_store_n(&next->wait, false, __ATOMIC_RELEASE); // 直接交给下一个等待者
+
+out:
+  c->spin_used &= ~(1U << (n - c->spin_nodes));
+  pop_intr();
+}
+
+#endif
+
 /*
     cpu可能在某个执行流中获取多个自旋锁,在临界区内必须保证不被中断,武断地acquire~cli,release~sti会
   ! 导致一个锁被释放而开中断,但cpu可能还处在另一个锁的临界区中,容易死锁
-*/
\ No newline at end of file
+*/
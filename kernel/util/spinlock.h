@@ -1,15 +1,30 @@
 #pragma once
+#include "config.h"
 #include "types.h"
 
 struct cpu;
 
+/*
+  MCS排队自旋锁: 等待者按到达顺序在tail上排队,各自在本cpu的队列节点上自旋,锁按FIFO顺序直接交给下一个等待者
+  持有锁时关中断,节点取自本cpu的节点池(struct cpu的spin_nodes),同一cpu上同时持有或等待的自旋锁不超过NSPINNODE个
+  编译时定义SPIN_TAS则退化为原先的test-and-set自旋锁,用于对比
+*/
+struct mcs_node {
+  struct mcs_node* next; // 排在自己之后的等待者
+  bool wait;             // 前一个持有者释放锁时清零
+} __attribute__((aligned(CACHE_LINE)));
+
 struct spinlock {
   const char* lname;
-  bool locked;
+  struct mcs_node* tail; // 队尾节点,NULL表示锁空闲
+  struct mcs_node* node; // 持有者的节点
   struct cpu* cpu;
+#ifdef SPIN_TAS
+  bool locked;
+#endif
 };
 
 void spin_get(struct spinlock* lock);
 void spin_put(struct spinlock* lock);
 
-#define INIT_SPINLOCK(name) struct spinlock name = { .lname = #name, .locked = false, .cpu = NULL }
+#define INIT_SPINLOCK(name) struct spinlock name = { .lname = #name, .tail = NULL, .node = NULL, .cpu = NULL }
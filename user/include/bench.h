@@ -0,0 +1,46 @@
+#pragma once
+#include "usys.h"
+#include "kernel/config.h"
+
+/*
+  基准测试程序共用的计时与输出
+  用户态通过rdtime读取time计数(start中开放了scounteren.TM),频率为TIMEBASE_FREQ
+*/
+
+static inline __attribute__((always_inline)) unsigned long
+now(void)
+{
+  unsigned long t;
+  asm volatile("rdtime %0" : "=r"(t));
+  return t;
+}
+
+static inline void
+putnum(unsigned long x)
+{
+  char buf[24];
+  int i = sizeof(buf);
+  do
+    buf[--i] = '0' + x % 10;
+  while (x /= 10);
+  write(STDOUT, buf + i, sizeof(buf) - i);
+}
+
+static inline void
+putstr(const char* s)
+{
+  int n = 0;
+  while (s[n])
+    ++n;
+  write(STDOUT, s, n);
+}
+
+// 解析命令行中的十进制数,没有时返回def
+static inline int
+argnum(const char* option, int def)
+{
+  int n = 0;
+  while (option && *option >= '0' && *option <= '9')
+    n = n * 10 + *option++ - '0';
+  return n > 0 ? n : def;
+}
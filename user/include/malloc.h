@@ -0,0 +1,188 @@
+#pragma once
+#include "usys.h"
+
+/*
+  用户态内存分配器
+  小块(<=1024字节)按16,32,...,1024共7个尺寸级别分配,每个级别一条空闲块双向链表
+  每个页只切分一种尺寸的块,页首为struct mpage
+  页内块全部释放后: 每个级别保留一个完整的空页(块仍在空闲链表上),其余空页摘除块后放入空页链表供任意级别复用,
+  空页超过MEMPTY_HIGH个时才成批munmap到MEMPTY_LOW个,反复申请释放同一个小块不会陷入内核
+  大块直接按页申请,页首同样为struct mpage,释放时整体munmap
+  页通过sbrk批量申请(MPOOL_PAGES页一次陷入),未切分的页留在页池中
+*/
+
+#define MPAGE_SIZE   4096UL
+#define MPOOL_PAGES  16
+#define MEMPTY_HIGH  16
+#define MEMPTY_LOW   8
+#define MCLASS_MIN   16UL
+#define MCLASS_CNT   7
+#define MSMALL_MAX   (MCLASS_MIN << (MCLASS_CNT - 1))
+#define MCLASS_LARGE MCLASS_CNT
+
+struct mpage {
+  unsigned int cls;  // 尺寸级别,MCLASS_LARGE表示大块
+  unsigned int used; // 小块: 已分配块数 | 大块: 页数
+  unsigned long pad; // 保持块16字节对齐
+};
+
+struct mblock {
+  struct mblock* next;
+  struct mblock* prev;
+};
+
+struct mempty {
+  struct mempty* next;
+};
+
+static struct {
+  bool init;
+  char *pool, *pool_end; // 页池 [pool,pool_end)
+  struct mblock free[MCLASS_CNT];
+  struct mpage* spare[MCLASS_CNT]; // 各级别保留的空页
+  struct mempty* empty;            // 已摘除块的空页
+  unsigned int nempty;
+} mheap __attribute__((unused));
+
+static inline struct mpage*
+mpage_of(void* p)
+{
+  return (struct mpage*)((unsigned long)p & ~(MPAGE_SIZE - 1));
+}
+
+static inline void
+mblock_unlink(struct mblock* b)
+{
+  b->prev->next = b->next;
+  b->next->prev = b->prev;
+}
+
+static inline void
+mblock_push(struct mblock* head, struct mblock* b)
+{
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+}
+
+static inline struct mpage*
+mpage_get(void)
+{
+  if (mheap.empty) {
+    struct mempty* e = mheap.empty;
+    mheap.empty = e->next;
+    --mheap.nempty;
+    return (struct mpage*)e;
+  }
+  if (mheap.pool == mheap.pool_end) {
+    char* p = sbrk(MPOOL_PAGES * MPAGE_SIZE);
+    if (p == NULL)
+      return NULL;
+    mheap.pool = p;
+    mheap.pool_end = p + MPOOL_PAGES * MPAGE_SIZE;
+  }
+  struct mpage* pg = (struct mpage*)mheap.pool;
+  mheap.pool += MPAGE_SIZE;
+  return pg;
+}
+
+// 取一页切分为cls级别的块并加入空闲链表
+static inline bool
+mrefill(int cls)
+{
+  struct mpage* pg = mpage_get();
+  if (pg == NULL)
+    return false;
+  unsigned long size = MCLASS_MIN << cls;
+  pg->cls = cls;
+  pg->used = 0;
+  for (char* b = (char*)(pg + 1); b + size <= (char*)pg + MPAGE_SIZE; b += size)
+    mblock_push(&mheap.free[cls], (struct mblock*)b);
+  return true;
+}
+
+static inline void*
+mlarge(unsigned long n)
+{
+  if (n >= (1UL << 30)) // sbrk的参数为int
+    return NULL;
+  unsigned long npage = (n + sizeof(struct mpage) + MPAGE_SIZE - 1) / MPAGE_SIZE;
+  struct mpage* pg = sbrk(npage * MPAGE_SIZE);
+  if (pg == NULL)
+    return NULL;
+  pg->cls = MCLASS_LARGE;
+  pg->used = npage;
+  return pg + 1;
+}
+
+static inline void*
+malloc(unsigned long n)
+{
+  if (n == 0)
+    return NULL;
+  if (! mheap.init) {
+    for (int i = 0; i < MCLASS_CNT; ++i)
+      mheap.free[i].next = mheap.free[i].prev = &mheap.free[i];
+    mheap.init = true;
+  }
+  if (n > MSMALL_MAX)
+    return mlarge(n);
+
+  int cls = 0;
+  while ((MCLASS_MIN << cls) < n)
+    ++cls;
+  struct mblock* head = &mheap.free[cls];
+  if (head->next == head && ! mrefill(cls))
+    return NULL;
+  struct mblock* b = head->next;
+  mblock_unlink(b);
+  struct mpage* pg = mpage_of(b);
+  if (pg->used++ == 0 && mheap.spare[cls] == pg)
+    mheap.spare[cls] = NULL;
+  return b;
+}
+
+// 空页过多时成批还给内核;munmap失败(如vma数已达上限)时留在空页链表中
+static inline void
+mempty_trim(void)
+{
+  while (mheap.nempty > MEMPTY_LOW) {
+    struct mempty* e = mheap.empty;
+    mheap.empty = e->next;
+    if (munmap(e, MPAGE_SIZE) < 0) {
+      mheap.empty = e;
+      return;
+    }
+    --mheap.nempty;
+  }
+}
+
+static inline void
+free(void* p)
+{
+  if (p == NULL)
+    return;
+  struct mpage* pg = mpage_of(p);
+  if (pg->cls == MCLASS_LARGE) {
+    munmap(pg, pg->used * MPAGE_SIZE);
+    return;
+  }
+
+  unsigned long size = MCLASS_MIN << pg->cls;
+  mblock_push(&mheap.free[pg->cls], p);
+  if (--pg->used)
+    return;
+  if (mheap.spare[pg->cls] == NULL) { // 保留为本级别的空页
+    mheap.spare[pg->cls] = pg;
+    return;
+  }
+  // 本级别已有空页: 摘除页内所有块后放入空页链表
+  for (char* b = (char*)(pg + 1); b + size <= (char*)pg + MPAGE_SIZE; b += size)
+    mblock_unlink((struct mblock*)b);
+  struct mempty* e = (struct mempty*)pg;
+  e->next = mheap.empty;
+  mheap.empty = e;
+  if (++mheap.nempty > MEMPTY_HIGH)
+    mempty_trim();
+}
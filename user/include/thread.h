@@ -0,0 +1,96 @@
+#pragma once
+#include "usys.h"
+
+/*
+  用户态线程库
+  线程栈通过sbrk申请,栈顶放置struct tstart记录入口与参数,由tstart_entry调用fn后exit
+  thread_join回收线程后将栈munmap还给内核;同时存在的线程最多TMAX个
+  互斥锁基于futex,无竞争时加锁解锁都不陷入内核
+*/
+
+#define TSTACK_SIZE (4096UL * 4)
+#define TMAX        16
+
+struct tstart {
+  void (*fn)(void*);
+  void* arg;
+};
+
+static struct {
+  int tid;
+  char* stack;
+} tstacks[TMAX] __attribute__((unused));
+
+static inline void
+tstart_entry(void* p)
+{
+  struct tstart* ts = p;
+  ts->fn(ts->arg);
+  exit(0);
+}
+
+// 创建线程执行fn(arg),返回tid,失败返回-1
+static inline int
+thread_create(void (*fn)(void*), void* arg)
+{
+  int i = 0;
+  while (i < TMAX && tstacks[i].stack)
+    ++i;
+  if (i == TMAX)
+    return -1;
+  char* stack = sbrk(TSTACK_SIZE);
+  if (stack == NULL)
+    return -1;
+  struct tstart* ts = (struct tstart*)(stack + TSTACK_SIZE) - 1; // 16字节,栈顶保持对齐
+  ts->fn = fn;
+  ts->arg = arg;
+  int tid = thread(tstart_entry, ts, ts);
+  if (tid < 0) {
+    munmap(stack, TSTACK_SIZE);
+    return -1;
+  }
+  tstacks[i].tid = tid;
+  tstacks[i].stack = stack;
+  return tid;
+}
+
+static inline int
+thread_join(int tid, int* status)
+{
+  if (join(tid, status) < 0)
+    return -1;
+  for (int i = 0; i < TMAX; ++i)
+    if (tstacks[i].stack && tstacks[i].tid == tid) {
+      munmap(tstacks[i].stack, TSTACK_SIZE);
+      tstacks[i].stack = NULL;
+    }
+  return 0;
+}
+
+// v: 0未加锁 1已加锁 2已加锁且可能有等待者
+struct mutex {
+  int v;
+};
+
+static inline void
+mutex_lock(struct mutex* m)
+{
+  int c = __sync_val_compare_and_swap(&m->v, 0, 1);
+  if (c == 0)
+    return;
+  if (c != 2)
+    c = __sync_lock_test_and_set(&m->v, 2);
+  while (c != 0) {
+    futex_wait(&m->v, 2, 0);
+    c = __sync_lock_test_and_set(&m->v, 2);
+  }
+}
+
+static inline void
+mutex_unlock(struct mutex* m)
+{
+  if (__sync_fetch_and_sub(&m->v, 1) != 1) { // 可能有等待者
+    __sync_lock_release(&m->v);
+    futex_wake(&m->v, 1);
+  }
+}
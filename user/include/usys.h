@@ -1,6 +1,8 @@
 #pragma once
 #define USER
 #include "kernel/fs/file.h"
+#include "kernel/mem/vm.h"
+#include "kernel/task/sche.h"
 
 #define NULL nullptr
 int fork(void);
@@ -20,10 +22,26 @@ int rmdir(const char* path);
 int mknod(const char* path, unsigned int dev); // 只能创建字符设备文件
 int chdir(const char* path);
 void* alloc(void);
-int free(void* addr);
+int pfree(void* addr); // 释放alloc申请的页,free留给malloc.h
 int pipe(int fd[2]);
 int ls(void);
 int sleep(int scalar);
+void* mmap(int fd, int off, int len, enum prot prot, enum map_flag flags);
+int munmap(void* addr, int len);
+void* sbrk(int n);
+int memstat(int pid, struct memstat* ms);
+int setpriority(int pid, int nice);
+int nanosleep(unsigned long ns);
+int sched_setaffinity(int pid, unsigned long mask);
+int sched_getaffinity(int pid, unsigned long* mask);
+int thread(void (*fn)(void*), void* stack, void* arg); // fn不能返回,结束时调用exit
+int join(int tid, int* status);
+int futex_wait(int* addr, int val, unsigned long ns); // ns为0表示不超时
+int futex_wake(int* addr, int n);
+int schedstat(int pid, struct schedstat* st);
+int vlen(void); // 向量寄存器位宽(bit),0表示不支持向量扩展
+int spawn(const char* path, const char* option, const int* fds); // 创建运行path的子进程,fds以-1结尾,子进程的文件i为当前进程的文件fds[i],NULL继承全部
+int sched_setscheduler(int pid, int policy, int prio); // policy为SCHED_NORMAL时prio为0,实时策略的prio为1~RT_PRIO_MAX
 
 #define STDIN  0
 #define STDOUT 1
\ No newline at end of file
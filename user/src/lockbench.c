@@ -0,0 +1,61 @@
+#include "bench.h"
+#include "thread.h"
+
+#define DURATION (TIMEBASE_FREQ / 2) // 每轮测试时长(time计数)
+
+static unsigned long end;  // 本轮结束时刻
+static int word;           // 所有线程futex_wake的同一个字,没有等待者
+static int tids[TMAX];
+
+/*
+  工作线程反复futex_wake同一个字: 各线程共享地址空间,键(物理地址)相同,每次都获取同一个futex桶的自旋锁
+  临界区只是遍历空的等待链表,耗时主要在锁的争用上;以完成的次数作为退出码交给join
+  不用dup/close: 共享的文件表本身没有锁保护,并发修改会破坏文件表
+*/
+static void
+worker(void*)
+{
+  int cnt = 0;
+  while (now() < end) {
+    futex_wake(&word, 1);
+    ++cnt;
+  }
+  exit(cnt);
+}
+
+/*
+  lockbench [n]: 依次以1..n个线程(最多TMAX个)争用同一个内核自旋锁,打印总吞吐量与各线程完成次数的最小/最大值
+  在不同-smp下分别以MCS锁与test-and-set锁(cmake -DSPIN_TAS=ON)构建内核运行,对比扩展性与公平性
+*/
+void
+main(const char* option)
+{
+  int max = argnum(option, 4);
+  if (max > TMAX)
+    max = TMAX;
+
+  for (int n = 1; n <= max; ++n) {
+    end = now() + DURATION;
+    int nt = 0;
+    while (nt < n && (tids[nt] = thread_create(worker, NULL)) >= 0)
+      ++nt;
+    unsigned long sum = 0, lo = ~0UL, hi = 0;
+    for (int i = 0; i < nt; ++i) {
+      int cnt = 0;
+      thread_join(tids[i], &cnt);
+      sum += cnt;
+      lo = cnt < lo ? cnt : lo;
+      hi = cnt > hi ? cnt : hi;
+    }
+    putstr("threads ");
+    putnum(nt);
+    putstr(" ops/s ");
+    putnum(sum * TIMEBASE_FREQ / DURATION);
+    putstr(" min ");
+    putnum(lo);
+    putstr(" max ");
+    putnum(hi);
+    putstr("\n");
+  }
+  exit(0);
+}
@@ -0,0 +1,65 @@
+#include "bench.h"
+
+#define ITER 100 // 每个工作进程fork的次数
+
+// 反复fork一个立即退出的子进程并回收,覆盖任务分配、物理页分配与调度路径
+static void
+worker(void)
+{
+  for (int i = 0; i < ITER; ++i) {
+    if (fork() == 0)
+      exit(0);
+    wait(NULL);
+  }
+  exit(0);
+}
+
+// 已启动的hart: sched_setaffinity拒绝只含未启动hart的mask
+static unsigned long
+online_harts(void)
+{
+  unsigned long online = 0;
+  for (int i = 0; i < 64; ++i)
+    if (sched_setaffinity(0, 1UL << i) == 0)
+      online |= 1UL << i;
+  sched_setaffinity(0, online);
+  return online;
+}
+
+/*
+  scale [n]: 依次限定在1,2,4,...,n个hart上(默认全部已启动的hart),每个hart运行一个工作进程
+  打印每种hart数下每秒的fork次数,观察吞吐量随hart数的扩展性
+  工作进程通过fork继承亲和性,因此只在选定的hart上运行;能测到的hart数上限由qemu的-smp(cmake -DSMP=n)决定
+*/
+void
+main(const char* option)
+{
+  unsigned long online = online_harts();
+  int nhart = __builtin_popcountl(online);
+  int max = argnum(option, nhart);
+  if (max > nhart)
+    max = nhart;
+
+  for (int n = 1; n <= max; n = (n == max || n * 2 <= max) ? n * 2 : max) {
+    unsigned long mask = 0, rest = online;
+    for (int i = 0; i < n; ++i) { // 取编号最小的n个已启动hart
+      mask |= rest & -rest;
+      rest &= rest - 1;
+    }
+    sched_setaffinity(0, mask);
+    unsigned long start = now();
+    for (int i = 0; i < n; ++i)
+      if (fork() == 0)
+        worker();
+    for (int i = 0; i < n; ++i)
+      wait(NULL);
+    unsigned long us = (now() - start) * 1000000 / TIMEBASE_FREQ;
+    putstr("harts ");
+    putnum(n);
+    putstr(" forks/s ");
+    putnum(n * ITER * 1000000UL / (us ? us : 1));
+    putstr("\n");
+  }
+  sched_setaffinity(0, online);
+  exit(0);
+}
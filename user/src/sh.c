@@ -11,6 +11,7 @@ static char epath[32] = "/bin/";
 static char input[128];
 static int pid, status, envsz;
 static enum command cmd;
+static const int stdfds[] = { STDIN, STDOUT, -1 };
 
 /*
   解析shell命令,返回false则为非法格式或非法命令
@@ -82,13 +83,11 @@ main(void)
       else
         ls();
     } else {
-      pid = fork();
-      if (pid == 0) {
-        exec(epath, option);
+      pid = spawn(epath, option, stdfds); // 子进程只继承标准输入输出,不复制shell的地址空间
+      if (pid < 0)
         write(STDOUT, "invalid cmd\n", 12);
-        exit(1);
-      }
-      wait(&status);
+      else
+        wait(&status);
     }
   }
 }
\ No newline at end of file